@@ -18,6 +18,7 @@
 #include <msp430.h>
 #include <stdbool.h>
 #include <string.h>
+#include "AT89_Trace.h"
 
 #define UART_RXD        BIT1  //P1.1 To TXD of slave
 #define UART_TXD        BIT2  //P1.2 To RXD of slave
@@ -29,6 +30,7 @@
 #define AT89_RST        BIT3  //P2.3 AT89 reset
 
 #define LED             BIT2  //P2.2 LED
+#define CLONE_BUTTON    BIT4  //P2.4 Button to ground, runs K
 
 #define XOFF            0x13
 #define XON             0x11
@@ -40,19 +42,179 @@ void UART_Hex(unsigned char data);
 void ProgStart();
 void SPI_Send(unsigned char data);
 unsigned char SPI_Receive();
+void SPI_ReadBlock(unsigned char *data, int count);
 void ProgDelayStop();
 void ProgStop();
 unsigned char CmdEnable();
+unsigned char CmdReset(unsigned long ticks);
+bool CmdAttach();
 void CmdErase();
-void CmdPollBusy();
+void CmdPollBusy(unsigned char budget_ms);
+void CmdPollPage();
+void CmdIdentify();
+void CmdReadSignature(unsigned char *signature);
+bool CmdSwapped();
+void CmdReadPage(unsigned int page);
+void CmdClone();
+void CmdReadConfig(unsigned char *fuses, unsigned char *locks);
+void CmdConfig(unsigned char *text);
+int Config_Apply(unsigned char *shadow, unsigned char *flags, int count);
 
 void SPI_Text(unsigned char *data);
 
+void UART_XOff();
+void UART_XOn();
+void UART_Hex32(unsigned long data);
+unsigned long Timer_Now();
+void Timer_Wait(unsigned long ticks);
+unsigned long UART_WaitQuiet();
+void Stats_Reset();
+void Stats_Report();
+void Verify_Mismatch(unsigned int address, unsigned char expected, unsigned char actual);
+void Verify_Report();
+void Trace_Log(unsigned char event);
+void Trace_Write(unsigned int address);
+bool Trace_Reopen(unsigned char event);
+void Trace_Put(unsigned int entry);
+void Trace_Dump(unsigned int start);
+unsigned char Patch_Apply(unsigned int address, unsigned char data);
+void Patch_Finish(bool write);
+void Flash_Erase(unsigned int offset);
+void Flash_Write(unsigned int offset, unsigned char *data, int count);
+bool Clone_Append(unsigned int address, unsigned char *data, int count);
+void Clone_Erase();
+bool Clone_Flush();
+void Clone_Replay(bool write);
+long ParseHex(unsigned char *text, int digits);
+bool Hex_Read(unsigned char *buffer, int *ptr, unsigned char *crc);
+
 void delay_ms(int ms);
 
-#define RINGBUFFERSIZE    64
-#define SPIBUFFERSIZE     64
-#define UARTRXBUFFERSIZE  64
+void SPI_Reset();
+bool SPI_Settled();
+void Fault_Post(unsigned char code);
+void Fault_Report();
+
+#define UART_CLOCK        16000000UL//SMCLK
+#ifndef UART_BR
+#define UART_BR           0x115//57.6k: 16MHz/57600=277.78, 0x341 and BRS 3 for 19.2k
+#define UART_BRS          6//Fraction*8 rounded, into UCBRS
+#endif
+#define UART_BAUD         (UART_CLOCK*8/(UART_BR*8+UART_BRS))//What the dividers give, 57605
+#define SPI_DIVIDER       4
+#define TIMER_HZ          2000000//SMCLK/8
+#define TIMER_MS          (TIMER_HZ/1000)
+
+#define ATTACH_MIN_MS     1//Reset pulse and settle time, doubled on each retry
+#define ATTACH_MAX_MS     4
+#define ATTACH_POLL_MS    10//Target presence check while idle at the prompt
+#define BUTTON_MS         20//Debounce, the button must still be down after this
+
+//Geometry and worst case timing of each supported part, picked by the
+//signature read at attach time. Busy polls give up after the budget.
+typedef struct
+{
+  unsigned char signature[3];
+  char *name;
+  unsigned long flash_size;
+  unsigned char page_size;
+  unsigned char fuse_count;
+  unsigned char write_ms;
+  unsigned char erase_ms;
+} AT89Device;
+
+const AT89Device Device_Table[]={
+  {{0x1E,0x64,0xFF},"AT89LP6440",0x10000,64,12,10,100},
+  {{0x1E,0x32,0xFF},"AT89LP3240",0x8000,64,12,10,100},
+  {{0x1E,0x88,0xFF},"AT89LP828",0x2000,32,10,10,50},
+  {{0x1E,0x48,0xFF},"AT89LP428",0x1000,32,10,10,50}};
+
+#define DEVICE_TYPES      (sizeof(Device_Table)/sizeof(Device_Table[0]))
+#define MAXPAGESIZE       64
+#define MAXFUSES          12
+#define LOCKBYTES         2
+
+const AT89Device *Device=&Device_Table[0];
+unsigned char Device_Signature[3];//As read by the last CmdIdentify
+
+//Last page read back from the target, shared by every record in that page
+unsigned char Page_Buff[MAXPAGESIZE];
+unsigned int Page_Address;
+bool Page_Valid;
+
+//Verify failures as runs of consecutive bad bytes. Expected and actual are
+//for the first byte of each run.
+#define MISMATCHLISTSIZE  4
+
+unsigned int Mismatch_Address[MISMATCHLISTSIZE];
+unsigned int Mismatch_Length[MISMATCHLISTSIZE];
+unsigned char Mismatch_Expected[MISMATCHLISTSIZE];
+unsigned char Mismatch_Actual[MISMATCHLISTSIZE];
+int Mismatch_Count;
+unsigned int Mismatch_Dropped;
+
+//Per unit overrides applied to the image as it streams through L, set
+//with P and N. The serial field steps once per completed load. Bytes the
+//image does not cover are written on their own after its last record.
+#define PATCHTABLESIZE    4
+
+unsigned int Patch_Address[PATCHTABLESIZE];
+unsigned char Patch_Value[PATCHTABLESIZE];
+int Patch_Count;
+unsigned int Patch_Covered;//Bit per patch entry, then per serial byte from bit 8
+
+unsigned int Serial_Address;
+unsigned char Serial_Length;
+unsigned long Serial_Value;
+bool Serial_Used;
+
+//Image cached in spare MSP430 flash by U and replayed by K. The header
+//holds a magic byte, written last, then the signature and fuses of the
+//master unit. Each target page with data is compressed into tokens growing
+//up from the header: a skip over 1-64 blank bytes, 1-64 literal bytes, or
+//one byte repeated 1-64 times, with an erased byte ending the page. The
+//index grows down from the end of the store, one entry per page holding
+//its target address and where its tokens start, and ends at the first
+//erased entry. The image sits in .rodata so the linker places it in flash;
+//every read goes through the volatile pointer since the compiler would
+//otherwise fold in the 0xFF it was initialized with.
+#define CLONESTORESIZE    4096
+#define CLONESEGMENTSIZE  512
+#define CLONEHEADERSIZE   16
+#define CLONESIGNATURE    1//Header offsets
+#define CLONEFUSES        4//Room for MAXFUSES
+#define CLONEMAGIC        0xA5
+#define CLONEINDEXSIZE    4
+#define CLONEKIND         0xC0//Token type bits, the rest is the count less one
+#define CLONESKIP         0x00
+#define CLONECOPY         0x40
+#define CLONEREPEAT       0x80
+#define CLONEEND          0xC0//Erased
+#define CLONENOPAGE       0xFFFF
+#ifndef CLONEQUIETMS
+#define CLONEQUIETMS      20//Silence after XOFF before a flash write. USB serial adapters send up to 16ms late
+#endif
+#define FLASH_DIVIDER     39//16MHz/40 is inside the 257-476kHz window
+
+const unsigned char Clone_Image[CLONESTORESIZE] __attribute__((section(".rodata.clonestore"),aligned(CLONESEGMENTSIZE)))={[0 ... CLONESTORESIZE-1]=0xFF};
+volatile const unsigned char * const Clone_Store=Clone_Image;
+unsigned int Clone_Ptr;//Next free token byte
+unsigned int Clone_Index;//Lowest index entry written
+unsigned int Clone_Page;//Page U is assembling in Page_Buff
+
+//Overridable so the host stress harness can sweep them. A 32 byte RX ring
+//holds up to about 300k baud in sim/stress.sh; a full TX or SPI ring only
+//stalls the main loop, 4 to 64 bytes give the same safe rate there and 8
+//cost under 0.1% in sim/bench.sh.
+#ifndef RINGBUFFERSIZE
+#define RINGBUFFERSIZE    8
+#endif
+#ifndef SPIBUFFERSIZE
+#define SPIBUFFERSIZE     8
+#endif
+#ifndef UARTRXBUFFERSIZE
+#define UARTRXBUFFERSIZE  32
+#endif
 
 volatile unsigned char UART_RingBuff[RINGBUFFERSIZE];
 volatile int UART_RingCount;
@@ -73,6 +235,79 @@ volatile int SPI_ReceiveReady;
 volatile unsigned char SPI_ReceiveBuff;
 volatile bool SPI_SendStop;
 
+//Faults are only recorded by ISRs and low level routines. The main loop
+//reports them, so nothing blocks on the TX ring from interrupt context.
+#define FAULT_RX_RING       0
+#define FAULT_RX_BUFFER     1
+#define FAULT_SPI_START     2
+#define FAULT_SPI_STOP      3
+#define FAULT_SPI_SS        4
+#define FAULT_SPI_OVERFLOW  5
+#define FAULT_BUSY_TIMEOUT  6
+#define FAULT_CLONE_FULL    7
+#define FAULT_RANGE         8
+#define FAULT_CHECKSUM      9
+#define FAULT_CLONE_PART    10
+#define FAULT_RX_FLASH      11
+#define FAULT_TYPES         12
+
+#define FAULTQUEUESIZE    4
+#define FAULTWAITLOOPS    10000
+
+char * const Fault_Text[FAULT_TYPES]={
+  "RX RING OVERFLOW.",
+  "RX BUFFER OVERFLOW.",
+  "SPI START ERROR.",
+  "BUFFER NOT EMPTY.",
+  "SS NOT LOW.",
+  "SPI BUFFER OVERFLOW. REDUCE BAUD RATE.",
+  "FLASH BUSY TIMEOUT.",
+  "CLONE STORE FULL.",
+  "RECORD BEYOND FLASH.",
+  "BAD CHECKSUM.",
+  "CLONE IMAGE IS FOR ANOTHER PART.",
+  "DATA DURING FLASH WRITE. RAISE CLONEQUIETMS."};
+
+volatile unsigned char Fault_Queue[FAULTQUEUESIZE];
+volatile int Fault_QueueCount;
+volatile int Fault_QueuePtr;
+volatile unsigned char Fault_Counts[FAULT_TYPES];//Saturate at FF
+volatile bool Fault_Abort;
+
+//Throughput counters in Timer_A ticks, read out with the B command
+volatile unsigned int Timer_Overflows;
+volatile unsigned long Stats_RxBytes;
+unsigned long Stats_Start;
+unsigned long Stats_Xoff;
+unsigned long Stats_XoffStart;
+unsigned long Stats_Busy;
+unsigned long Stats_TxStall;
+unsigned long Stats_SpiStall;
+bool Stats_XoffActive;
+volatile int Stats_RxHigh;
+int Stats_TxHigh;
+int Stats_SpiHigh;
+
+//Timeline of the last few SPI and UART events, dumped with T, in the
+//format of AT89_Trace.h: 8us steps, with a wrap entry whenever TA0R has
+//wrapped since the last one. The ring stops at the first fault to keep the
+//lead up. A page under L logs about 7 entries, so T<address> holds the ring
+//until a page write starts at or past that address, then keeps the first
+//TRACEBUFFERSIZE entries from there.
+#define TRACEBUFFERSIZE   16
+
+unsigned int Trace_Buff[TRACEBUFFERSIZE];
+int Trace_Ptr;
+int Trace_Count;
+unsigned int Trace_Wraps;//Timer_Overflows as of the last entry
+volatile unsigned int Trace_Start;//Armed trigger address, 0 when off
+volatile bool Trace_Hold;
+bool Trace_Once;//Triggered, hold once full
+
+//Fault injection for finding the highest safe baud rate, set with D
+unsigned char Inject_BusyMs;
+unsigned char Inject_XoffMs;
+
 void main(void)
 {
   WDTCTL=WDTPW + WDTHOLD;
@@ -82,43 +317,44 @@ void main(void)
 
   UCA0CTL1=UCSWRST|UCSSEL_2;
   UCA0CTL0 = 0;
-  //19.2k
-  //UCA0MCTL = UCBRS_3+UCBRF_0;
-  //UCA0BR0 = 0x41;
-  //UCA0BR1 = 0x03;
-
-  //57.6kk
-  UCA0MCTL = UCBRS_6+UCBRF_0;
-  UCA0BR0 = 0x15;
-  UCA0BR1 = 0x01;
+  UCA0MCTL = (UART_BRS<<1)+UCBRF_0;//UCBRS_6 at 57.6k
+  UCA0BR0 = UART_BR&0xFF;
+  UCA0BR1 = UART_BR>>8;
   UCA0CTL1&=~UCSWRST;
 
   UCB0CTL1=UCSWRST;
   UCB0CTL0=UCCKPH|UCMST|UCSYNC|UCMSB;//or UCCKPL?
   UCB0CTL1|=UCSSEL_2;
-  UCB0BR0=4;//5mhz max so 4 should work
+  UCB0BR0=SPI_DIVIDER;//5mhz max so 4 should work
   UCB0BR1=0;
   UCB0CTL1&=~UCSWRST;
 
   UC0IE|=UCA0TXIE|UCA0RXIE|UCB0TXIE|UCB0RXIE;
+
+  TA0CTL=TASSEL_2|ID_3|MC_2|TACLR|TAIE;
+  Timer_Overflows=0;
+
+  FCTL2=FWKEY|FSSEL_1|FLASH_DIVIDER;
   __enable_interrupt();
 
   P1OUT=AT89_SS;
   P1DIR=AT89_SS;
 
-  P2OUT=LED+AT89_RST;
+  P2OUT=LED+AT89_RST+CLONE_BUTTON;
   P2DIR=LED+AT89_RST;
+  P2REN=CLONE_BUTTON;//Pull up
 
   P1SEL=AT89_CLOCK|AT89_MISO|AT89_MOSI|UART_RXD|UART_TXD;
   P1SEL2=AT89_CLOCK|AT89_MISO|AT89_MOSI|UART_RXD|UART_TXD;
 
-  #define INBUFFLEN 50
+  #define INBUFFLEN 72//Room for a 64 byte page record
 
-  int inptr=0,i,j;
+  int inptr=0,i;
   unsigned char inbuffer[INBUFFLEN]={0};
-  unsigned char inkey,oddbyte,crc;
+  unsigned char inkey,status,crc;
   unsigned int address,offset,start_address;
-  bool eof;
+  unsigned long idle;
+  bool eof,running,attached;
 
   while (1)
   {
@@ -137,6 +373,16 @@ void main(void)
     SPI_ReceiveCount=0;
     SPI_SendStop=false;
 
+    Fault_QueueCount=0;
+    Fault_QueuePtr=0;
+    Fault_Abort=false;
+    for (i=0;i<FAULT_TYPES;i++) Fault_Counts[i]=0;
+
+    Stats_XoffActive=false;
+    Stats_Reset();
+    Inject_BusyMs=0;
+    Inject_XoffMs=0;
+
     P1OUT|=AT89_SS;
 
     UC0IFG&=~(UCA0TXIFG|UCA0RXIFG|UCB0TXIFG|UCB0RXIFG);
@@ -148,33 +394,70 @@ void main(void)
     P1SEL|=(AT89_CLOCK|AT89_MISO|AT89_MOSI);
     P1SEL2|=(AT89_CLOCK|AT89_MISO|AT89_MOSI);
 
-    delay_ms(10);
-    P2OUT|=AT89_RST;
-    delay_ms(10);
-    P2OUT&=~AT89_RST;
-    delay_ms(10);
-
-    UART_Text("\r\n\nAT89LP6440 PROGRAMMER v0.1\r\n>");
-    UART_Send(XON);
+    UART_Text("\r\n\nAT89LP6440 PROGRAMMER v0.1\r\n");
+    UART_XOn();
+    attached=CmdAttach();
+    UART_Text(">");
+    running=false;
+    idle=Timer_Now();
 
     do
     {
-      i=0;
-      if (CmdEnable()!=0x53)
+      while (!UART_RxCount)
       {
-        UART_Text("COULD NOT CONNECT. PRESS ANY KEY TO RECONNECT.\r\n");
-        UART_Receive();
-        i=1;
+        if ((!running)&&(Timer_Now()-idle>=ATTACH_POLL_MS*TIMER_MS))
+        {
+          if (!attached)//Ctrl-C left CmdAttach, keep trying quietly
+          {
+            if (CmdReset(ATTACH_MIN_MS*TIMER_MS)==0x53)
+            {
+              UART_Text("\r\nCONNECTED.\r\n");
+              CmdIdentify();
+              attached=true;
+              UART_Text(">");
+              UART_Text((char *)inbuffer);
+            }
+          }
+          else if (CmdEnable()!=0x53)
+          {
+            UART_Text("\r\nTARGET REMOVED.\r\n");
+            attached=CmdAttach();
+            UART_Text(">");
+            UART_Text((char *)inbuffer);
+          }
+          else if (CmdSwapped())
+          {
+            UART_Text("\r\nTARGET CHANGED.\r\n");
+            CmdIdentify();
+            UART_Text(">");
+            UART_Text((char *)inbuffer);
+          }
+          else if (!(P2IN&CLONE_BUTTON))
+          {
+            Timer_Wait(BUTTON_MS*TIMER_MS);
+            if (!(P2IN&CLONE_BUTTON))
+            {
+              UART_Text("\r\nBUTTON.\r\n");
+              Fault_Report();
+              Fault_Abort=false;
+              CmdClone();
+              UART_Text("\r\n>");
+              UART_Text((char *)inbuffer);
+              while (!(P2IN&CLONE_BUTTON));//One clone per press
+              Timer_Wait(BUTTON_MS*TIMER_MS);
+            }
+          }
+          idle=Timer_Now();
+        }
       }
-    }while(i==1);
-
-    do
-    {
       inkey=UART_Receive();
+      idle=Timer_Now();
 
       if (inkey==13)
       {
         if (inptr) UART_Text("\r\n");
+        Fault_Report();
+        Fault_Abort=false;
         if (inptr==0)
         {
           //inkey=3;//reconnect when enter
@@ -188,231 +471,332 @@ void main(void)
         }
         else if (!strcmp(inbuffer,"L"))
         {
-          oddbyte=0;
           crc=0;
           inptr=0;
           eof=false;
+          if (Serial_Used)
+          {
+            Serial_Value++;
+            Serial_Used=false;
+          }
+          Patch_Covered=0;
           do
           {
-            inkey=UART_Receive();
-            if (inkey==3) break;
-            if ((inkey>='a')&&(inkey<='f')) inkey-=32;
-            if (((inkey>='0')&&(inkey<='9'))||((inkey>='A')&&(inkey<='F')))
+            if (!Hex_Read(inbuffer,&inptr,&crc))
             {
-              if (inkey<='9') inkey-='0';
-              else inkey-=55;
-
-              if (oddbyte==0) inbuffer[inptr]=inkey*16;
+              inkey=3;
+              break;
+            }
+            if (inptr==3)
+            {
+              address=inbuffer[1]*256+inbuffer[2];
+              start_address=address;
+              offset=4;
+              if ((unsigned long)address+inbuffer[0]>Device->flash_size) Fault_Post(FAULT_RANGE);
+            }
+            else if (inbuffer[0]==inptr-5)
+            {
+              if (crc) UART_Send('C');//Bad checksum
               else
               {
-                inbuffer[inptr]+=inkey;
-                crc+=inbuffer[inptr];
-                inptr++;
-              }
-              oddbyte=~oddbyte;
-
-              if (!oddbyte)
-              {
-                if (inptr==3)
-                {
-                  address=inbuffer[1]*256+inbuffer[2];
-                  start_address=address;
-                  offset=4;
-                }
-                else if (inbuffer[0]==inptr-5)
+                UART_Send('.');
+                UART_XOff();
+                if (inbuffer[3]==1)
                 {
-                  if (oddbyte) UART_Send('U');//Odd number of bytes!
-                  else if (crc) UART_Send('C');//Bad checksum
-                  else
-                  {
-                    UART_Send('.');
-                    UART_Send(XOFF);
-                    if (inbuffer[3]==1)
-                    {
-                      eof=true;
-                      inkey=0;
-                    }
-                    else
-                    {
-                      if (!(P1OUT|AT89_SS))
-                      {
-                        UART_Text("\r\nSPI BUFFER OVERFLOW. REDUCE BAUD RATE.\r\n");
-                        while (UART_Receive()!=3);
-                        eof=true;
-                      }
-                      else
-                      {
-                        j=0;
-                        ProgStart();
-                        SPI_Send(0xAA);
-                        SPI_Send(0x55);
-                        SPI_Send(0x60);
-                        SPI_Send('X');
-                        SPI_Send('Y');
-
-                        do
-                        {
-                          i=SPI_Receive();
-                        } while (!(i&1));
-                        ProgStop();
-                        /*if (!(i&1))
-                        {
-                          UART_Text("\r\nFLASH BUSY. REDUCE BAUD RATE.\r\n");
-                          while (UART_Receive()!=3);
-                          eof=true;
-                        }*/
-                      }
-
-                      if (eof==false)
-                      {
-                        ProgStart();
-                        SPI_Send(0xAA);
-                        SPI_Send(0x55);
-                        SPI_Send(0x50);
-                        SPI_Send(start_address>>8);
-                        SPI_Send(start_address&0xFF);
-                        for (i=offset;i<inptr-1;i++) SPI_Send(inbuffer[i]);
-                        ProgDelayStop();
-                      }
-                    }
-                  }
-                  oddbyte=0;
-                  crc=0;
-                  inptr=0;
-                  UART_Send(XON);
+                  eof=true;
+                  inkey=0;
                 }
-                else if (inptr>4)
+                else if ((inbuffer[3]==0)&&((int)offset<inptr-1)&&(!Fault_Abort))//Skip empty tails of page aligned records
                 {
-                  address++;
-                  if ((address&63)==0)
+                  if ((!SPI_Settled())||(!(P1OUT&AT89_SS))) Fault_Post(FAULT_SPI_OVERFLOW);//Last page still shifting out, keep reading to the end
+                  else CmdPollPage();
+
+                  if (!Fault_Abort)
                   {
-                    ProgStart();
-                    SPI_Send(0xAA);
-                    SPI_Send(0x55);
-                    SPI_Send(0x60);
-                    SPI_Send('X');
-                    SPI_Send('Y');
-
-                    do
-                    {
-                      i=SPI_Receive();
-                    } while (!(i&1));
-                    ProgStop();
-
-                    /*if (!(i&1))
-                    {
-                      UART_Text("\r\nFLASH BUSY. REDUCE BAUD RATE.\r\n");
-                      while (UART_Receive()!=3);
-                      eof=true;
-                    }*/
-
-                    UART_Send(XOFF);
                     ProgStart();
                     SPI_Send(0xAA);
                     SPI_Send(0x55);
                     SPI_Send(0x50);
+                    Trace_Write(start_address);
                     SPI_Send(start_address>>8);
                     SPI_Send(start_address&0xFF);
-                    for (i=offset;i<inptr;i++) SPI_Send(inbuffer[i]);
+                    for (i=offset;i<inptr-1;i++) SPI_Send(inbuffer[i]);
                     ProgDelayStop();
-                    start_address=address;
-                    offset=inptr;
-                    UART_Send(XON);
                   }
                 }
               }
+              crc=0;
+              inptr=0;
+              UART_XOn();
+            }
+            else if (inptr>4)
+            {
+              if (inbuffer[3]==0) inbuffer[inptr-1]=Patch_Apply(address,inbuffer[inptr-1]);
+              address++;
+              if (((address&(Device->page_size-1))==0)&&(!Fault_Abort))
+              {
+                UART_XOff();//Before the busy poll, which can outlast the RX ring
+                CmdPollPage();
+                ProgStart();
+                SPI_Send(0xAA);
+                SPI_Send(0x55);
+                SPI_Send(0x50);
+                Trace_Write(start_address);
+                SPI_Send(start_address>>8);
+                SPI_Send(start_address&0xFF);
+                for (i=offset;i<inptr;i++) SPI_Send(inbuffer[i]);
+                ProgDelayStop();
+                start_address=address;
+                offset=inptr;
+                UART_XOn();
+              }
             }
           } while(!eof);
-          if (inkey!=3) UART_Receive();
+          if (inkey!=3)
+          {
+            UART_Receive();
+            if (!Fault_Abort) Patch_Finish(true);
+          }
+          CmdPollPage();//Let the last page finish before the presence poll talks to the target
           UART_Text("\r\n");
+          if (Fault_Abort)
+          {
+            Fault_Report();
+            UART_Text("\r\nLOADING FAILED\r\n");
+          }
+          else if ((inkey!=3)&&(Serial_Length))
+          {
+            UART_Text("SERIAL ");
+            UART_Hex32(Serial_Value);
+            UART_Text("\r\n");
+            Serial_Used=true;
+          }
         }
         else if (!strcmp(inbuffer,"V"))
         {
-          oddbyte=0;
+          status=0;//Bit 0 failed, bit 1 mismatch in this record
           crc=0;
           inptr=0;
           eof=false;
+          Page_Valid=false;
+          Mismatch_Count=0;
+          Mismatch_Dropped=0;
+          Patch_Covered=0;
           do
           {
-            inkey=UART_Receive();
-            if (inkey==3) break;
-            if ((inkey>='a')&&(inkey<='f')) inkey-=32;
-            if (((inkey>='0')&&(inkey<='9'))||((inkey>='A')&&(inkey<='F')))
+            if (!Hex_Read(inbuffer,&inptr,&crc))
             {
-              if (inkey<='9') inkey-='0';
-              else inkey-=55;
-
-              if (oddbyte==0) inbuffer[inptr]=inkey*16;
-              else
+              inkey=3;
+              break;
+            }
+            if ((inptr==4)&&(inbuffer[3]==0))
+            {
+              address=inbuffer[1]*256+inbuffer[2];
+              offset=4;
+              if ((unsigned long)address+inbuffer[0]>Device->flash_size) Fault_Post(FAULT_RANGE);
+            }
+            else if (inbuffer[0]==inptr-5)
+            {
+              if (inbuffer[3]==1)
               {
-                inbuffer[inptr]+=inkey;
-                inptr++;
+                eof=true;
+                inkey=0;
               }
-              oddbyte=~oddbyte;
+              if (crc)
+              {
+                UART_Send('C');//Bad checksum, the comparison means nothing
+                status|=1;
+              }
+              else if (status&2) UART_Send('x');
+              else UART_Send('.');
+              status&=~2;
+              crc=0;
+              inptr=0;
+              address=0;
+            }
+            else if ((inptr>4)&&(inbuffer[3]==0)&&((unsigned long)address<Device->flash_size))
+            {
+              if ((!Page_Valid)||((address&~(Device->page_size-1))!=Page_Address))
+              {
+                CmdReadPage(address&~(Device->page_size-1));
+              }
+              i=Page_Buff[address&(Device->page_size-1)];
+              inbuffer[inptr-1]=Patch_Apply(address,inbuffer[inptr-1]);
+              if (i!=inbuffer[inptr-1])
+              {
+                Verify_Mismatch(address,inbuffer[inptr-1],i);
+                status=2|1;
+              }
+              address++;
+            }
+          } while(!eof);
+          if (inkey!=3)
+          {
+            UART_Receive();
+            Patch_Finish(false);
+            if (Mismatch_Count) status|=1;
+            if (Fault_Abort)
+            {
+              Fault_Report();
+              status|=1;
+            }
+            Verify_Report();
+            if (status==0) UART_Text("\r\nVERIFYING DONE\r\n");
+            else UART_Text("\r\nVERIFYING FAILED\r\n");
+          }
+        }
+
+        else if (!strcmp(inbuffer,"U"))
+        {
+          Clone_Erase();
 
-              if (!oddbyte)
+          crc=0;
+          inptr=0;
+          eof=false;
+          do
+          {
+            if (!Hex_Read(inbuffer,&inptr,&crc))
+            {
+              inkey=3;
+              break;
+            }
+            if ((inptr>4)&&(inbuffer[0]==inptr-5))
+            {
+              if (crc)
               {
-                if ((inptr==4)&&(inbuffer[3]==0))
-                {
-                  address=inbuffer[1]*256+inbuffer[2];
-                  offset=4;
-                  UART_Send(XOFF);
-                  ProgStart();
-                  SPI_Send(0xAA);
-                  SPI_Send(0x55);
-                  SPI_Send(0x30);
-                  SPI_Send(address>>8);
-                  SPI_Send(address&0xFF);
-                  UART_Send(XON);
-                }
-                else if (inbuffer[0]==inptr-5)
+                UART_Send('C');
+                Fault_Post(FAULT_CHECKSUM);//A store missing a record must not be marked valid
+              }
+              else
+              {
+                UART_Send('.');
+                if (inbuffer[3]==1)
                 {
-                  if (inbuffer[3]==1)
-                  {
-                    eof=true;
-                    inkey=0;
-                  }
-                  ProgStop();
-                  oddbyte=0;
-                  inptr=0;
-                  address=0;
-                  if (crc&2) UART_Send('x');
-                  else UART_Send('.');
-                  crc&=~2;
+                  eof=true;
+                  inkey=0;
                 }
-                else if (inptr>4)
+                else if ((inbuffer[3]==0)&&(!Fault_Abort))
                 {
-                  i=SPI_Receive();
-                  //UART_Hex(i);
-                  if (i!=inbuffer[inptr-1])
-                  {
-                    crc=2|1;
-                  }
-                  address++;
-                  if ((address&63)==0)
-                  {
-                    UART_Send(XOFF);
-                    ProgStop();
-                    ProgStart();
-                    SPI_Send(0xAA);
-                    SPI_Send(0x55);
-                    SPI_Send(0x30);
-                    SPI_Send(address>>8);
-                    SPI_Send(address&0xFF);
-                    UART_Send(XON);
-                  }
+                  if (inbuffer[1]*256UL+inbuffer[2]+inbuffer[0]>Device->flash_size) Fault_Post(FAULT_RANGE);
+                  else if (!Clone_Append(inbuffer[1]*256+inbuffer[2],inbuffer+4,inbuffer[0])) Fault_Post(FAULT_CLONE_FULL);
                 }
               }
+              crc=0;
+              inptr=0;
             }
           } while(!eof);
-          if (inkey!=3)
+          if (inkey!=3) UART_Receive();
+          if ((inkey!=3)&&(!Fault_Abort)&&(!Clone_Flush())) Fault_Post(FAULT_CLONE_FULL);
+          UART_Text("\r\n");
+          if (Fault_Abort)
           {
-            UART_Receive();
-            if (crc==0) UART_Text("\r\nVERIFYING DONE\r\n");
-            else UART_Text("\r\nVERIFYING FAILED\r\n");
+            Fault_Report();
+            UART_Text("\r\nSTORING FAILED\r\n");
+          }
+          else if (inkey!=3)
+          {
+            ProgStart();
+            SPI_Send(0xAA);
+            SPI_Send(0x55);
+            SPI_Send(0x61);
+            SPI_Send(0x00);
+            SPI_Send(0x00);
+            SPI_ReadBlock(inbuffer+3,Device->fuse_count);
+            ProgStop();
+            for (i=0;i<3;i++) inbuffer[i]=Device_Signature[i];
+            Flash_Write(CLONESIGNATURE,inbuffer,3+Device->fuse_count);
+            inbuffer[0]=CLONEMAGIC;
+            Flash_Write(0,inbuffer,1);
+            UART_Text("STORED ");
+            i=Clone_Ptr+CLONESTORESIZE-Clone_Index;
+            UART_Hex(i>>8);
+            UART_Hex(i&0xFF);
+            UART_Text(" BYTES\r\n");
+          }
+        }
+        else if (!strcmp(inbuffer,"K"))
+        {
+          CmdClone();
+        }
+        else if (inbuffer[0]=='T')
+        {
+          if (inptr==1) Trace_Dump(0);
+          else if ((inptr!=5)||(ParseHex(inbuffer+1,4)<0)) UART_Text("USAGE: T<START ADDRESS> IN HEX.");
+          else
+          {
+            Trace_Dump(ParseHex(inbuffer+1,4));
+            UART_Text("\r\nTRACE ARMED.");
+          }
+        }
+        else if (!strcmp(inbuffer,"B"))
+        {
+          Stats_Report();
+          Stats_Reset();
+        }
+        else if (inbuffer[0]=='D')
+        {
+          if (inptr==1)
+          {
+            Inject_BusyMs=0;
+            Inject_XoffMs=0;
+            UART_Text("INJECTION OFF.");
+          }
+          else if ((inptr!=5)||(ParseHex(inbuffer+1,4)<0)) UART_Text("USAGE: D<BUSY MS><XOFF MS> IN HEX.");
+          else
+          {
+            Inject_BusyMs=ParseHex(inbuffer+1,2);
+            Inject_XoffMs=ParseHex(inbuffer+3,2);
+            UART_Text("INJECTION SET.");
+          }
+        }
+        else if (inbuffer[0]=='P')
+        {
+          if (inptr==1)
+          {
+            Patch_Count=0;
+            UART_Text("PATCHES CLEARED.");
+          }
+          else if ((inptr<7)||(!(inptr&1))||(ParseHex(inbuffer+1,4)<0)) UART_Text("USAGE: P<ADDRESS><BYTES> IN HEX.");
+          else if (Patch_Count+(inptr-5)/2>PATCHTABLESIZE) UART_Text("PATCH TABLE FULL.");
+          else
+          {
+            for (i=5;(i<inptr)&&(ParseHex(inbuffer+i,2)>=0);i+=2);//Whole line checked before the table changes
+            if (i<inptr) UART_Text("USAGE: P<ADDRESS><BYTES> IN HEX.");
+            else
+            {
+              address=ParseHex(inbuffer+1,4);
+              for (i=5;i<inptr;i+=2)
+              {
+                Patch_Address[Patch_Count]=address++;
+                Patch_Value[Patch_Count++]=ParseHex(inbuffer+i,2);
+              }
+              UART_Text("PATCH SET.");
+            }
+          }
+        }
+        else if (inbuffer[0]=='N')
+        {
+          if (inptr==1)
+          {
+            Serial_Length=0;
+            UART_Text("SERIAL OFF.");
+          }
+          else if ((inptr<7)||(inptr>13)||(!(inptr&1))||(ParseHex(inbuffer+1,4)<0)) UART_Text("USAGE: N<ADDRESS><1 TO 4 BYTE START VALUE> IN HEX.");
+          else
+          {
+            unsigned long value=0;//The old serial stays on a bad line
+            for (i=5;(i<inptr)&&(ParseHex(inbuffer+i,2)>=0);i+=2) value=(value<<8)|ParseHex(inbuffer+i,2);
+            if (i<inptr) UART_Text("USAGE: N<ADDRESS><1 TO 4 BYTE START VALUE> IN HEX.");
+            else
+            {
+              Serial_Value=value;
+              Serial_Address=ParseHex(inbuffer+1,4);
+              Serial_Length=(inptr-5)/2;
+              Serial_Used=false;
+              UART_Text("SERIAL SET.");
+            }
           }
         }
-
         else if (!strcmp(inbuffer,"R"))
         {
           P1SEL&=~(AT89_CLOCK|AT89_MISO|AT89_MOSI);
@@ -420,6 +804,7 @@ void main(void)
           P1DIR&=~(AT89_CLOCK|AT89_MISO|AT89_MOSI);
 
           P2OUT|=AT89_RST;
+          running=true;
         }
         else if (!strcmp(inbuffer,"S"))
         {
@@ -545,7 +930,7 @@ void main(void)
           SPI_Send(0x61);
           SPI_Send(0x00);
           SPI_Send(0x00);
-          for (i=0;i<12;i++)
+          for (i=0;i<Device->fuse_count;i++)
           {
             UART_Hex(SPI_Receive());
             UART_Send(' ');
@@ -553,88 +938,28 @@ void main(void)
           ProgStop();
           UART_Text("\r\n");
         }
-        else if (inbuffer[0]=='F')
+        else if ((inbuffer[0]=='F')||(inbuffer[0]=='J'))
         {
-          if (inptr>13) UART_Text("TOO MANY FUSES. MAX IS 12.");
-          else
-          {
-            eof=false;
-            ProgStart();
-            SPI_Send(0xAA);
-            SPI_Send(0x55);
-            SPI_Send(0x61);
-            SPI_Send(0x00);
-            SPI_Send(0x00);
-            for (i=0;i<12;i++)
-            {
-              if (((i+2)>inptr)||(inbuffer[i+1]=='X')) inbuffer[i]=SPI_Receive();
-              else
-              {
-                SPI_Receive();
-                if (inbuffer[i+1]=='1') inbuffer[i]=0xFF;
-                else if (inbuffer[i+1]=='0') inbuffer[i]=0;
-                else
-                {
-                  eof=true;
-                  UART_Text("VALID FLAGS ARE 1, 0, and X.");
-                  UART_Hex(i);
-                  UART_Hex(inptr);
-                  break;
-                }
-              }
-            }
-            ProgStop();
-
-            if (!eof)
-            {
-              ProgStart();
-              SPI_Send(0xAA);
-              SPI_Send(0x55);
-              SPI_Send(0xF1);
-              SPI_Send(0x00);
-              SPI_Send(0x00);
-
-              for (i=0;i<12;i++) SPI_Send(inbuffer[i]);
-              ProgStop();
-              UART_Text("FUSES SET.\r\n");
-            }
-          }
+          CmdConfig(inbuffer);
         }
-        /*else if (!strcmp(inbuffer,"H"))
+        else if (!strcmp(inbuffer,"H"))
         {
           UART_Text("LOCK BITS: ");
-          ProgStart();
-          SPI_Send(0xAA);
-          SPI_Send(0x55);
-          SPI_Send(0x64);
-          SPI_Send(0x00);
-          SPI_Send(0x00);
-          UART_Hex(SPI_Receive());
-          UART_Send(' ');
-          UART_Hex(SPI_Receive());
-          ProgStop();
-        }*/
-        /*else if (!strcmp(inbuffer,"J"))
-        {
-          UART_Text("WRITING LOCK BITS");
-          ProgStart();
-          SPI_Send(0xAA);
-          SPI_Send(0x55);
-          SPI_Send(0xE4);
-          SPI_Send(0x00);
-          SPI_Send(0x00);
-          SPI_Send(0xFF);
-          SPI_Send(0xFF);
-          UART_Hex(SPI_Receive());
-          UART_Send(' ');
-          UART_Hex(SPI_Receive());
-          ProgStop();
-        }*/
+          CmdReadConfig(inbuffer,inbuffer+MAXFUSES);
+          for (i=0;i<LOCKBYTES;i++)
+          {
+            UART_Hex(inbuffer[MAXFUSES+i]);
+            UART_Send(' ');
+          }
+          UART_Text("\r\n");
+        }
         else
         {
           UART_Text("UNKOWN COMMAND");
         }
 
+        Fault_Report();
+        idle=Timer_Now();//Time spent in the command is not idle time
         if ((inkey==13)&&(inptr==0))
         {
           UART_Text("\r\n>");
@@ -672,6 +997,11 @@ void main(void)
   }
 }
 
+__attribute__((interrupt(TIMER0_A1_VECTOR))) static void TIMER0_A1_ISR(void)
+{
+  if (TA0IV==TA0IV_TAIFG) Timer_Overflows++;
+}
+
 __attribute__((interrupt(USCIAB0TX_VECTOR))) static void USCI0TX_ISR(void)
 {
   int i;
@@ -711,20 +1041,33 @@ __attribute__((interrupt(USCIAB0RX_VECTOR))) static void USCI0RX_ISR(void)
 {
   if ((UC0IFG&UCA0RXIFG)&&(UC0IE&UCA0RXIE))
   {
-    UART_RxBuff[UART_RxPtr]=UCA0RXBUF;
-    UART_RxPtr++;
-    if (UART_RxPtr==UARTRXBUFFERSIZE) UART_RxPtr=0;
-    UART_RxCount++;
-    if (UART_RxCount==UARTRXBUFFERSIZE) UART_Text("\r\nRX RING OVERFLOW.\r\n");
-    if (UCA0STAT & UCOE) UART_Text("\r\nRX BUFFER OVERFLOW.\r\n");;
+    if (UCA0STAT & UCOE) Fault_Post(FAULT_RX_BUFFER);
+    if (UART_RxCount==UARTRXBUFFERSIZE)
+    {
+      UCA0RXBUF;//Drop the byte rather than overwrite unread ones
+      Fault_Post(FAULT_RX_RING);
+    }
+    else
+    {
+      UART_RxBuff[UART_RxPtr]=UCA0RXBUF;
+      UART_RxPtr++;
+      if (UART_RxPtr==UARTRXBUFFERSIZE) UART_RxPtr=0;
+      UART_RxCount++;
+      if (UART_RxCount>Stats_RxHigh) Stats_RxHigh=UART_RxCount;
+    }
+    Stats_RxBytes++;
   }
 
   if ((UC0IFG&UCB0RXIFG)&&(UC0IE&UCB0RXIE))//maybe remove these to save time
   {
+    //A byte that finished while this ISR was held off sets UCOE instead of
+    //a second flag, so it is counted here or SPI_Receive waits forever
+    if (UCB0STAT&UCOE) SPI_ReceiveCount--;
     SPI_ReceiveCount--;
-    if (SPI_ReceiveCount==0)
+    SPI_ReceiveBuff=UCB0RXBUF;//Clears the flag and UCOE
+    if (SPI_ReceiveCount<=0)
     {
-      SPI_ReceiveBuff=UCB0RXBUF;
+      SPI_ReceiveCount=0;
       if (SPI_SendStop)
       {
         //while (P2IN&1);//This is untested. Blocking here could be bad.
@@ -732,12 +1075,12 @@ __attribute__((interrupt(USCIAB0RX_VECTOR))) static void USCI0RX_ISR(void)
         SPI_SendStop=false;
       }
     }
-    UC0IFG&=~UCB0RXIFG;
   }
 }
 
 void UART_Send(unsigned char data)
 {
+  unsigned long t;
   UC0IE&=~UCA0TXIE;
   if (UART_RingReady)
   {
@@ -750,8 +1093,16 @@ void UART_Send(unsigned char data)
     UART_RingPtr++;
     if (UART_RingPtr==RINGBUFFERSIZE) UART_RingPtr=0;
     UART_RingCount++;
+    if (UART_RingCount>Stats_TxHigh) Stats_TxHigh=UART_RingCount;
     UC0IE|=UCA0TXIE;
-    while(UART_RingCount==RINGBUFFERSIZE);
+    if (UART_RingCount==RINGBUFFERSIZE)
+    {
+      t=Timer_Now();
+      if (!Trace_Reopen(TRACE_TXSTALL)) Trace_Log(TRACE_TXSTALL);
+      while(UART_RingCount==RINGBUFFERSIZE);
+      Trace_Log(TRACE_STALLDONE);
+      Stats_TxStall+=Timer_Now()-t;
+    }
   }
   UC0IE|=UCA0TXIE;
 }
@@ -781,6 +1132,29 @@ unsigned char UART_Receive()
   return buff;
 }
 
+void UART_XOff()
+{
+  if (Inject_XoffMs) delay_ms(Inject_XoffMs);//Models a host slow to honor XOFF
+  UART_Send(XOFF);
+  Trace_Log(TRACE_XOFF);
+  if (!Stats_XoffActive)
+  {
+    Stats_XoffStart=Timer_Now();
+    Stats_XoffActive=true;
+  }
+}
+
+void UART_XOn()
+{
+  UART_Send(XON);
+  Trace_Log(TRACE_XON);
+  if (Stats_XoffActive)
+  {
+    Stats_Xoff+=Timer_Now()-Stats_XoffStart;
+    Stats_XoffActive=false;
+  }
+}
+
 void UART_Hex(unsigned char data)
 {
   unsigned char buff;
@@ -794,30 +1168,41 @@ void UART_Hex(unsigned char data)
   UART_Send(buff);
 }
 
+void UART_Hex32(unsigned long data)
+{
+  UART_Hex(data>>24);
+  UART_Hex(data>>16);
+  UART_Hex(data>>8);
+  UART_Hex(data);
+}
+
 void ProgStart()
 {
+  int i=0;
+  while ((!SPI_Settled())&&(i<FAULTWAITLOOPS)) i++;//Delayed stop may still be draining
   if (!(P1OUT&AT89_SS))
   {
-    UART_Text("\r\nSPI START ERROR.\r\n");
-    while (UART_Receive()!=3);
+    Fault_Post(FAULT_SPI_START);
+    SPI_Reset();
   }
   P1OUT&=~AT89_SS;
 }
 
 void SPI_Send(unsigned char data)
 {
-  static int i=0;
-  i++;
+  int i=0;
+  unsigned long t;
+  while ((SPI_SendStop)&&(i<FAULTWAITLOOPS)) i++;
   if (SPI_SendStop)
   {
-    UART_Text("\r\nBUFFER NOT EMPTY.\r\n");
-    while (UART_Receive()!=3);
+    Fault_Post(FAULT_SPI_STOP);
+    SPI_Reset();
+    P1OUT&=~AT89_SS;
   }
   if (P1OUT&AT89_SS)
   {
-    UART_Text("\r\nSS NOT LOW.\r\n");
-    UART_Hex(i);
-    while (UART_Receive()!=3);
+    Fault_Post(FAULT_SPI_SS);
+    return;
   }
 
   UC0IE&=~(UCB0TXIE|UCB0RXIE);
@@ -834,8 +1219,34 @@ void SPI_Send(unsigned char data)
     if (SPI_RingPtr==SPIBUFFERSIZE) SPI_RingPtr=0;
     SPI_RingCount++;
     SPI_ReceiveCount++;
+    if (SPI_RingCount>Stats_SpiHigh) Stats_SpiHigh=SPI_RingCount;
     UC0IE|=UCB0TXIE|UCB0RXIE;
-    while(SPI_RingCount==SPIBUFFERSIZE) UART_Send('!');//does this actually work?
+    if (SPI_RingCount==SPIBUFFERSIZE)
+    {
+      t=Timer_Now();
+      Trace_Log(TRACE_SPISTALL);
+      while(SPI_RingCount==SPIBUFFERSIZE);
+      Trace_Log(TRACE_STALLDONE);
+      Stats_SpiStall+=Timer_Now()-t;
+    }
+  }
+  UC0IE|=UCB0TXIE|UCB0RXIE;
+}
+
+//Clocks count bytes straight through the USCI once the ring has drained,
+//without the per byte interrupt round trip of SPI_Receive.
+void SPI_ReadBlock(unsigned char *data, int count)
+{
+  int i;
+  while (!SPI_Settled());
+  while (UCB0STAT & UCBUSY);
+  UC0IE&=~(UCB0TXIE|UCB0RXIE);
+  UC0IFG&=~UCB0RXIFG;
+  for (i=0;i<count;i++)
+  {
+    UCB0TXBUF='Z';
+    while (!(UC0IFG&UCB0RXIFG));
+    data[i]=UCB0RXBUF;
   }
   UC0IE|=UCB0TXIE|UCB0RXIE;
 }
@@ -846,11 +1257,11 @@ unsigned char SPI_Receive()
   //SPI_ReceiveReady=2;
   SPI_Send('Z');
   //UC0IE|=UCB0RXIE;
-  while (SPI_ReceiveCount)
+  while (!SPI_Settled())
   {
     //UART_Hex(SPI_ReceiveReady);
   }
-  return SPI_ReceiveBuff;
+  return UCB0RXBUF;//Holds the last byte even if its interrupt missed it
 }
 
 void ProgDelayStop()
@@ -885,33 +1296,361 @@ unsigned char CmdEnable()
   return buff;
 }
 
-void CmdErase()
+//Holds reset for ticks, lets the part settle as long and tries program enable
+unsigned char CmdReset(unsigned long ticks)
 {
-  ProgStart();
-  SPI_Send(0xAA);
-  SPI_Send(0x55);
-  SPI_Send(0x8A);
-  ProgStop();
-  CmdPollBusy();
-  return;
+  P2OUT|=AT89_RST;
+  Timer_Wait(ticks);
+  P2OUT&=~AT89_RST;
+  Timer_Wait(ticks);
+  return CmdEnable();
 }
 
-void CmdPollBusy()
+//Pulses reset and retries program enable with a doubling backoff until
+//the target answers, so a freshly seated board attaches on its own. Ctrl-C
+//gives up and leaves it to the presence poll at the prompt.
+bool CmdAttach()
 {
-  unsigned char buff;
-  ProgStart();
-  SPI_Send(0xAA);
-  SPI_Send(0x55);
-  SPI_Send(0x60);
-  SPI_Send('X');
-  SPI_Send('Y');
-  do
+  unsigned long backoff=ATTACH_MIN_MS*TIMER_MS;
+  bool waiting=false;
+  while (CmdReset(backoff)!=0x53)
   {
-    buff=SPI_Receive();
-    //UART_Hex(buff);
-    //UART_Send(' ');
-  }while(!(buff&1));
-  ProgStop();
+    if (!waiting)
+    {
+      UART_Text("COULD NOT CONNECT. WAITING FOR TARGET.\r\n");
+      waiting=true;
+    }
+    while (UART_RxCount)
+    {
+      if (UART_Receive()==3)
+      {
+        UART_Text("NO TARGET.\r\n");
+        return false;
+      }
+    }
+    if (backoff<ATTACH_MAX_MS*TIMER_MS) backoff*=2;
+  }
+  if (waiting) UART_Text("CONNECTED.\r\n");
+  CmdIdentify();
+  return true;
+}
+
+//Selects the device table entry. Unknown parts keep AT89LP6440 geometry.
+//Every attach, reconnect and swap comes through here, so nothing read from
+//the previous board outlives it
+void CmdIdentify()
+{
+  unsigned char *signature=Device_Signature;
+  int i,j;
+  Page_Valid=false;
+  CmdReadSignature(signature);
+
+  Device=&Device_Table[0];
+  for (i=0;i<(int)DEVICE_TYPES;i++)
+  {
+    for (j=0;j<3;j++) if (Device_Table[i].signature[j]!=signature[j]) break;
+    if (j==3)
+    {
+      Device=&Device_Table[i];
+      UART_Text(Device->name);
+      UART_Text("\r\n");
+      return;
+    }
+  }
+  UART_Text("UNKNOWN DEVICE ");
+  for (i=0;i<3;i++) UART_Hex(signature[i]);
+  UART_Text("\r\n");
+}
+
+void CmdReadSignature(unsigned char *signature)
+{
+  int i;
+  ProgStart();
+  SPI_Send(0xAA);
+  SPI_Send(0x55);
+  SPI_Send(0x38);
+  SPI_Send(0x00);
+  SPI_Send(0x00);
+  for (i=0;i<3;i++) signature[i]=SPI_Receive();
+  ProgStop();
+}
+
+//A board swapped between two presence polls answers program enable too,
+//so the poll also compares its signature with the identified one
+bool CmdSwapped()
+{
+  unsigned char signature[3];
+  CmdReadSignature(signature);
+  return memcmp(signature,Device_Signature,3)!=0;
+}
+
+void CmdReadPage(unsigned int page)
+{
+  ProgStart();
+  SPI_Send(0xAA);
+  SPI_Send(0x55);
+  SPI_Send(0x30);
+  Trace_Log(TRACE_CMD_READ);
+  SPI_Send(page>>8);
+  SPI_Send(page&0xFF);
+  SPI_ReadBlock(Page_Buff,Device->page_size);
+  ProgStop();
+  Page_Address=page;
+  Page_Valid=true;
+}
+
+//Erase, program, verify and set fuses from Clone_Store with no UART traffic
+void CmdClone()
+{
+  unsigned int idx,page;
+  int i;
+
+  if (Clone_Store[0]!=CLONEMAGIC)
+  {
+    UART_Text("NO CLONE IMAGE.");
+    return;
+  }
+  //A store taken from another part is refused before anything is erased
+  for (i=0;i<3;i++) if (Clone_Store[CLONESIGNATURE+i]!=Device_Signature[i]) break;
+  if (i<3) Fault_Post(FAULT_CLONE_PART);
+  for (idx=CLONESTORESIZE-CLONEINDEXSIZE;((page=Clone_Store[idx]*256+Clone_Store[idx+1])!=CLONENOPAGE)&&(!Fault_Abort);idx-=CLONEINDEXSIZE)
+  {
+    if ((page&(Device->page_size-1))||(page+(unsigned long)Device->page_size>Device->flash_size)) Fault_Post(FAULT_RANGE);
+  }
+  if (Fault_Abort)
+  {
+    Fault_Report();
+    UART_Text("\r\nCLONE FAILED");
+    return;
+  }
+  if (Serial_Used)
+  {
+    Serial_Value++;
+    Serial_Used=false;
+  }
+
+  CmdErase();
+  Patch_Covered=0;
+  Clone_Replay(true);
+  if (!Fault_Abort) Patch_Finish(true);
+
+  Page_Valid=false;
+  Mismatch_Count=0;
+  Mismatch_Dropped=0;
+  Patch_Covered=0;
+  Clone_Replay(false);
+  if (!Fault_Abort) Patch_Finish(false);
+
+  if ((!Fault_Abort)&&(!Mismatch_Count))
+  {
+    //Skip the fuse write when the target already matches. The page cache
+    //is done with by now and holds the fuses instead of the stack.
+    Page_Valid=false;
+    CmdReadConfig(Page_Buff,Page_Buff+MAXFUSES);
+    for (i=0;i<Device->fuse_count;i++) if (Page_Buff[i]!=Clone_Store[CLONEFUSES+i]) break;
+    if (i<Device->fuse_count)
+    {
+      ProgStart();
+      SPI_Send(0xAA);
+      SPI_Send(0x55);
+      SPI_Send(0xF1);
+      SPI_Send(0x00);
+      SPI_Send(0x00);
+      for (i=0;i<Device->fuse_count;i++) SPI_Send(Clone_Store[CLONEFUSES+i]);
+      ProgStop();
+      CmdPollBusy(Device->write_ms);
+    }
+  }
+
+  Fault_Report();
+  Verify_Report();
+  if ((Fault_Abort)||(Mismatch_Count)) UART_Text("\r\nCLONE FAILED");
+  else
+  {
+    UART_Text("CLONE DONE");
+    if (Serial_Length)
+    {
+      UART_Text(". SERIAL ");
+      UART_Hex32(Serial_Value);
+      Serial_Used=true;
+    }
+  }
+}
+
+void CmdReadConfig(unsigned char *fuses, unsigned char *locks)
+{
+  ProgStart();
+  SPI_Send(0xAA);
+  SPI_Send(0x55);
+  SPI_Send(0x61);
+  SPI_Send(0x00);
+  SPI_Send(0x00);
+  SPI_ReadBlock(fuses,Device->fuse_count);
+  ProgStop();
+
+  ProgStart();
+  SPI_Send(0xAA);
+  SPI_Send(0x55);
+  SPI_Send(0x64);
+  SPI_Send(0x00);
+  SPI_Send(0x00);
+  SPI_ReadBlock(locks,LOCKBYTES);
+  ProgStop();
+}
+
+//F<fuse flags>[J<lock flags>] or J<lock flags>, each flag 1, 0 or X. Fuses
+//and lock bits are read once into a shadow and only the groups that differ
+//from the request are written.
+void CmdConfig(unsigned char *text)
+{
+  unsigned char fuses[MAXFUSES],locks[LOCKBYTES];
+  unsigned char *fuse_flags=text+1,*lock_flags=0;
+  int fuse_len=0,lock_len=0,fuse_changed,lock_changed,i;
+
+  if (text[0]=='F')
+  {
+    while ((fuse_flags[fuse_len])&&(fuse_flags[fuse_len]!='J')) fuse_len++;
+    if (fuse_flags[fuse_len]=='J') lock_flags=fuse_flags+fuse_len+1;
+  }
+  else lock_flags=text+1;
+  if (lock_flags) lock_len=strlen((char *)lock_flags);
+
+  if (fuse_len>Device->fuse_count)
+  {
+    UART_Text("TOO MANY FUSES. MAX IS ");
+    UART_Hex(Device->fuse_count);
+    UART_Text(".");
+    return;
+  }
+  if (lock_len>LOCKBYTES)
+  {
+    UART_Text("TOO MANY LOCK BITS. MAX IS ");
+    UART_Hex(LOCKBYTES);
+    UART_Text(".");
+    return;
+  }
+
+  CmdReadConfig(fuses,locks);
+  fuse_changed=Config_Apply(fuses,fuse_flags,fuse_len);
+  for (i=0;i<lock_len;i++)
+  {
+    if ((lock_flags[i]=='1')&&(locks[i]!=0xFF))
+    {
+      UART_Text("LOCK BITS CAN ONLY BE CLEARED BY ERASING.");
+      return;
+    }
+  }
+  lock_changed=Config_Apply(locks,lock_flags,lock_len);
+  if ((fuse_changed<0)||(lock_changed<0))
+  {
+    UART_Text("VALID FLAGS ARE 1, 0, and X.");
+    return;
+  }
+
+  if (fuse_changed)
+  {
+    ProgStart();
+    SPI_Send(0xAA);
+    SPI_Send(0x55);
+    SPI_Send(0xF1);
+    SPI_Send(0x00);
+    SPI_Send(0x00);
+    for (i=0;i<Device->fuse_count;i++) SPI_Send(fuses[i]);
+    ProgStop();
+  }
+  if (lock_changed)
+  {
+    if (fuse_changed) CmdPollBusy(Device->write_ms);
+    ProgStart();
+    SPI_Send(0xAA);
+    SPI_Send(0x55);
+    SPI_Send(0xE4);
+    SPI_Send(0x00);
+    SPI_Send(0x00);
+    for (i=0;i<LOCKBYTES;i++) SPI_Send(locks[i]);
+    ProgStop();
+  }
+  if ((fuse_changed)||(lock_changed)) CmdPollBusy(Device->write_ms);
+
+  UART_Text("FUSES ");
+  UART_Hex(fuse_changed);
+  UART_Text(" LOCK BITS ");
+  UART_Hex(lock_changed);
+  UART_Text(" CHANGED.");
+}
+
+//Returns the number of bytes changed, or -1 for a bad flag
+int Config_Apply(unsigned char *shadow, unsigned char *flags, int count)
+{
+  int i,changed=0;
+  unsigned char value;
+  for (i=0;i<count;i++)
+  {
+    if (flags[i]=='X') continue;
+    else if (flags[i]=='1') value=0xFF;
+    else if (flags[i]=='0') value=0;
+    else return -1;
+    if (shadow[i]!=value)
+    {
+      shadow[i]=value;
+      changed++;
+    }
+  }
+  return changed;
+}
+
+void CmdErase()
+{
+  ProgStart();
+  SPI_Send(0xAA);
+  SPI_Send(0x55);
+  SPI_Send(0x8A);
+  Trace_Log(TRACE_CMD_ERASE);
+  ProgStop();
+  CmdPollBusy(Device->erase_ms);
+  return;
+}
+
+void CmdPollBusy(unsigned char budget_ms)
+{
+  unsigned char buff;
+  unsigned long t;
+  t=Timer_Now();
+  ProgStart();
+  SPI_Send(0xAA);
+  SPI_Send(0x55);
+  SPI_Send(0x60);
+  Trace_Log(TRACE_CMD_STATUS);
+  SPI_Send('X');
+  SPI_Send('Y');
+  do
+  {
+    buff=SPI_Receive();
+    //UART_Hex(buff);
+    //UART_Send(' ');
+    if ((!(buff&1))&&(Timer_Now()-t>budget_ms*TIMER_MS))
+    {
+      Fault_Post(FAULT_BUSY_TIMEOUT);
+      break;
+    }
+  }while((!(buff&1))&&(!Fault_Abort));
+  Trace_Log(TRACE_BUSYDONE);
+  ProgStop();
+  Stats_Busy+=Timer_Now()-t;
+}
+
+//Busy wait around a page write. Only here does D add its injected busy
+//time, so erase and fuse or lock writes keep their real timing.
+void CmdPollPage()
+{
+  unsigned long t;
+  CmdPollBusy(Device->write_ms);
+  if (Inject_BusyMs)
+  {
+    t=Timer_Now();
+    delay_ms(Inject_BusyMs);
+    Stats_Busy+=Timer_Now()-t;
+  }
 }
 
 void delay_ms(int ms)
@@ -919,3 +1658,599 @@ void delay_ms(int ms)
   while (ms--) __delay_cycles(16000);
 }
 
+//A receive interrupt held off past the next byte sees one flag for two
+//bytes and can leave SPI_ReceiveCount high. Once nothing is queued or
+//shifting the count is squared here, finishing any delayed stop.
+bool SPI_Settled()
+{
+  if (!SPI_ReceiveCount) return true;
+  if ((SPI_RingCount)||(!SPI_RingReady)||(UCB0STAT&UCBUSY)||(UC0IFG&UCB0RXIFG)) return false;
+  UC0IE&=~(UCB0TXIE|UCB0RXIE);
+  SPI_ReceiveCount=0;
+  if (SPI_SendStop)
+  {
+    P1OUT|=AT89_SS;
+    SPI_SendStop=false;
+  }
+  UC0IE|=UCB0TXIE|UCB0RXIE;
+  return true;
+}
+
+void SPI_Reset()
+{
+  UC0IE&=~(UCB0TXIE|UCB0RXIE);
+  while (UCB0STAT & UCBUSY);
+  P1OUT|=AT89_SS;
+  SPI_RingCount=0;
+  SPI_RingPtr=0;
+  SPI_RingReady=true;
+  SPI_ReceiveCount=0;
+  SPI_SendStop=false;
+  UC0IFG&=~(UCB0TXIFG|UCB0RXIFG);
+  UC0IE|=UCB0TXIE|UCB0RXIE;
+}
+
+//Safe to call from ISRs. Repeats of the newest fault are only counted.
+void Fault_Post(unsigned char code)
+{
+  int i;
+  bool enabled=UC0IE&UCA0RXIE;
+  UC0IE&=~UCA0RXIE;
+  if (Fault_Counts[code]!=0xFF) Fault_Counts[code]++;
+  Fault_Abort=true;
+  Trace_Hold=true;
+  Trace_Start=0;//A fault before the trigger leaves the ring empty
+  i=Fault_QueuePtr-1;
+  if (i<0) i+=FAULTQUEUESIZE;
+  if ((Fault_QueueCount<FAULTQUEUESIZE)&&((Fault_QueueCount==0)||(Fault_Queue[i]!=code)))
+  {
+    Fault_Queue[Fault_QueuePtr]=code;
+    Fault_QueuePtr++;
+    if (Fault_QueuePtr==FAULTQUEUESIZE) Fault_QueuePtr=0;
+    Fault_QueueCount++;
+  }
+  if (enabled) UC0IE|=UCA0RXIE;
+}
+
+void Fault_Report()
+{
+  int i;
+  unsigned char code;
+  while (Fault_QueueCount)
+  {
+    UC0IE&=~UCA0RXIE;
+    i=Fault_QueuePtr-Fault_QueueCount;
+    if (i<0) i+=FAULTQUEUESIZE;
+    code=Fault_Queue[i];
+    Fault_QueueCount--;
+    UC0IE|=UCA0RXIE;
+
+    UART_Text("\r\n");
+    UART_Text(Fault_Text[code]);
+    UART_Text(" COUNT ");
+    UART_Hex(Fault_Counts[code]);
+    UART_Text("\r\n");
+  }
+}
+
+//2MHz timebase. Checks TAIFG so an overflow not yet serviced is counted.
+unsigned long Timer_Now()
+{
+  unsigned int high,low;
+  do
+  {
+    high=Timer_Overflows;
+    low=TA0R;
+  } while (high!=Timer_Overflows);
+  if ((TA0CTL&TAIFG)&&(low<0x8000)) high++;
+  return ((unsigned long)high<<16)|low;
+}
+
+void Timer_Wait(unsigned long ticks)
+{
+  unsigned long start=Timer_Now();
+  while (Timer_Now()-start<ticks);
+}
+
+//Returns once no byte has arrived for CLONEQUIETMS, with the received byte
+//count, which must not move until the flash
+//write is done: the CPU takes no interrupts then and a second byte is lost.
+unsigned long UART_WaitQuiet()
+{
+  unsigned long count=Stats_RxBytes;
+  int ms=0;
+  while (ms<CLONEQUIETMS)
+  {
+    Timer_Wait(TIMER_MS);
+    if (count==Stats_RxBytes) ms++;
+    else
+    {
+      count=Stats_RxBytes;
+      ms=0;
+    }
+  }
+  return count;
+}
+
+void Stats_Reset()
+{
+  UC0IE&=~UCA0RXIE;
+  Stats_RxBytes=0;
+  Stats_RxHigh=0;
+  Fault_Counts[FAULT_RX_RING]=0;
+  Fault_Counts[FAULT_RX_BUFFER]=0;
+  UC0IE|=UCA0RXIE;
+  Stats_TxHigh=0;
+  Stats_SpiHigh=0;
+  Stats_Xoff=0;
+  Stats_Busy=0;
+  Stats_TxStall=0;
+  Stats_SpiStall=0;
+  Stats_Start=Timer_Now();
+  if (Stats_XoffActive) Stats_XoffStart=Stats_Start;
+}
+
+//One line of KEY=hex pairs so runs can be diffed between revisions.
+//Times are in HZ ticks.
+void Stats_Report()
+{
+  unsigned long now,rx,xoff;
+  now=Timer_Now();
+  UC0IE&=~UCA0RXIE;
+  rx=Stats_RxBytes;
+  UC0IE|=UCA0RXIE;
+  xoff=Stats_Xoff;
+  if (Stats_XoffActive) xoff+=now-Stats_XoffStart;
+
+  UART_Text("STATS HZ=");
+  UART_Hex32(TIMER_HZ);
+  UART_Text(" BAUD=");
+  UART_Hex32(UART_BAUD);
+  UART_Text(" SPIDIV=");
+  UART_Hex(SPI_DIVIDER);
+  UART_Text(" T=");
+  UART_Hex32(now-Stats_Start);
+  UART_Text(" RX=");
+  UART_Hex32(rx);
+  UART_Text(" XOFF=");
+  UART_Hex32(xoff);
+  UART_Text(" BUSY=");
+  UART_Hex32(Stats_Busy);
+  UART_Text(" TXSTALL=");
+  UART_Hex32(Stats_TxStall);
+  UART_Text(" SPISTALL=");
+  UART_Hex32(Stats_SpiStall);
+  UART_Text(" RXHIGH=");
+  UART_Hex(Stats_RxHigh);
+  UART_Text(" TXHIGH=");
+  UART_Hex(Stats_TxHigh);
+  UART_Text(" SPIHIGH=");
+  UART_Hex(Stats_SpiHigh);
+  UART_Text(" DROP=");
+  UART_Hex(Fault_Counts[FAULT_RX_RING]);
+  UART_Text(" OE=");
+  UART_Hex(Fault_Counts[FAULT_RX_BUFFER]);
+  UART_Text(" INJ=");
+  UART_Hex(Inject_BusyMs);
+  UART_Hex(Inject_XoffMs);
+}
+
+//Returns -1 if any of the digits is not hex
+long ParseHex(unsigned char *text, int digits)
+{
+  long value=0;
+  while (digits--)
+  {
+    value*=16;
+    if ((*text>='0')&&(*text<='9')) value+=*text-'0';
+    else if ((*text>='A')&&(*text<='F')) value+=*text-55;
+    else return -1;
+    text++;
+  }
+  return value;
+}
+
+//Receives the next byte of a HEX record into buffer[*ptr] for L, V and U
+//and adds it to *crc. Anything but hex digits is skipped and ':' starts
+//the record over. Returns false on Ctrl-C.
+bool Hex_Read(unsigned char *buffer, int *ptr, unsigned char *crc)
+{
+  unsigned char inkey,nibbles=0;
+  while (nibbles<2)
+  {
+    inkey=UART_Receive();
+    if (inkey==3) return false;
+    if (inkey==':')//Resync after dropped bytes
+    {
+      nibbles=0;
+      *crc=0;
+      *ptr=0;
+    }
+    if ((inkey>='a')&&(inkey<='f')) inkey-=32;
+    if (((inkey>='0')&&(inkey<='9'))||((inkey>='A')&&(inkey<='F')))
+    {
+      if (inkey<='9') inkey-='0';
+      else inkey-=55;
+
+      if (*ptr==INBUFFLEN) *ptr=0;//Runaway record
+      if (nibbles==0) buffer[*ptr]=inkey*16;
+      else buffer[*ptr]+=inkey;
+      nibbles++;
+    }
+  }
+  *crc+=buffer[*ptr];
+  (*ptr)++;
+  return true;
+}
+
+void Verify_Mismatch(unsigned int address, unsigned char expected, unsigned char actual)
+{
+  int i=Mismatch_Count-1;
+  if ((Mismatch_Count)&&(Mismatch_Address[i]+Mismatch_Length[i]==address)) Mismatch_Length[i]++;
+  else if (Mismatch_Count==MISMATCHLISTSIZE) Mismatch_Dropped++;
+  else
+  {
+    i=Mismatch_Count++;
+    Mismatch_Address[i]=address;
+    Mismatch_Length[i]=1;
+    Mismatch_Expected[i]=expected;
+    Mismatch_Actual[i]=actual;
+  }
+}
+
+void Verify_Report()
+{
+  int i;
+  for (i=0;i<Mismatch_Count;i++)
+  {
+    UART_Text("\r\nMISMATCH ");
+    UART_Hex(Mismatch_Address[i]>>8);
+    UART_Hex(Mismatch_Address[i]&0xFF);
+    UART_Send('+');
+    UART_Hex(Mismatch_Length[i]>>8);
+    UART_Hex(Mismatch_Length[i]&0xFF);
+    UART_Text(" EXP ");
+    UART_Hex(Mismatch_Expected[i]);
+    UART_Text(" GOT ");
+    UART_Hex(Mismatch_Actual[i]);
+  }
+  if (Mismatch_Dropped)
+  {
+    UART_Text("\r\nMORE MISMATCHES: ");
+    UART_Hex(Mismatch_Dropped>>8);
+    UART_Hex(Mismatch_Dropped&0xFF);
+  }
+}
+
+//Serial field bytes are big endian and win over a patch at the same address
+unsigned char Patch_Apply(unsigned int address, unsigned char data)
+{
+  int i;
+  for (i=0;i<Patch_Count;i++)
+  {
+    if (Patch_Address[i]==address)
+    {
+      Patch_Covered|=1<<i;
+      data=Patch_Value[i];
+      break;
+    }
+  }
+  if ((Serial_Length)&&(address-Serial_Address<Serial_Length))
+  {
+    Patch_Covered|=0x100<<(address-Serial_Address);
+    data=Serial_Value>>(8*(Serial_Length-1-(address-Serial_Address)));
+  }
+  return data;
+}
+
+//Writes, or for verify reads back, every serial and patch byte that the
+//image just streamed did not cover, one byte per page write
+void Patch_Finish(bool write)
+{
+  unsigned int address;
+  unsigned char data;
+  int i;
+  for (i=0;i<Serial_Length+Patch_Count;i++)
+  {
+    if (i<Serial_Length)
+    {
+      if (Patch_Covered&(0x100<<i)) continue;
+      address=Serial_Address+i;
+    }
+    else
+    {
+      if (Patch_Covered&(1<<(i-Serial_Length))) continue;
+      address=Patch_Address[i-Serial_Length];
+    }
+    data=Patch_Apply(address,0xFF);
+    if (address>=Device->flash_size)
+    {
+      Fault_Post(FAULT_RANGE);
+      continue;
+    }
+    if (write)
+    {
+      CmdPollPage();
+      ProgStart();
+      SPI_Send(0xAA);
+      SPI_Send(0x55);
+      SPI_Send(0x50);
+      Trace_Write(address);
+      SPI_Send(address>>8);
+      SPI_Send(address&0xFF);
+      SPI_Send(data);
+      ProgDelayStop();
+    }
+    else
+    {
+      if ((!Page_Valid)||((address&~(Device->page_size-1))!=Page_Address))
+      {
+        CmdReadPage(address&~(Device->page_size-1));
+      }
+      if (Page_Buff[address&(Device->page_size-1)]!=data)
+      {
+        Verify_Mismatch(address,data,Page_Buff[address&(Device->page_size-1)]);
+      }
+    }
+  }
+  if (write) CmdPollPage();
+}
+
+void Flash_Erase(unsigned int offset)
+{
+  FCTL3=FWKEY;
+  FCTL1=FWKEY|ERASE;
+  *(volatile unsigned char *)&Clone_Store[offset]=0;
+  while (FCTL3&BUSY);
+  FCTL1=FWKEY;
+  FCTL3=FWKEY|LOCK;
+}
+
+void Flash_Write(unsigned int offset, unsigned char *data, int count)
+{
+  int i;
+  FCTL3=FWKEY;
+  FCTL1=FWKEY|WRT;
+  for (i=0;i<count;i++)
+  {
+    *(volatile unsigned char *)&Clone_Store[offset+i]=data[i];
+    while (FCTL3&BUSY);
+  }
+  FCTL1=FWKEY;
+  FCTL3=FWKEY|LOCK;
+}
+
+//Decodes every indexed page and either writes it, one page write from its
+//first to its last stored byte, or reads it back and compares the stored
+//bytes. A page never ends in a skip, so one after the first stored byte is
+//a gap written as 0xFF; a patch landing there is verified by Patch_Finish.
+void Clone_Replay(bool write)
+{
+  unsigned int idx,ptr,page,pos;
+  unsigned char token,count,data;
+  bool started;
+  int i;
+
+  for (idx=CLONESTORESIZE-CLONEINDEXSIZE;((page=Clone_Store[idx]*256+Clone_Store[idx+1])!=CLONENOPAGE)&&(!Fault_Abort);idx-=CLONEINDEXSIZE)
+  {
+    ptr=Clone_Store[idx+2]*256+Clone_Store[idx+3];
+    pos=0;
+    started=false;
+    if (!write) CmdReadPage(page);
+    while (((token=Clone_Store[ptr++])&CLONEKIND)!=CLONEEND)
+    {
+      count=(token&~CLONEKIND)+1;
+      if ((token&CLONEKIND)==CLONESKIP)
+      {
+        if (started) for (i=0;i<count;i++,pos++) SPI_Send(Patch_Apply(page+pos,0xFF));//Already erased
+        else pos+=count;
+        continue;
+      }
+      if ((write)&&(!started))
+      {
+        ProgStart();
+        SPI_Send(0xAA);
+        SPI_Send(0x55);
+        SPI_Send(0x50);
+        Trace_Write(page+pos);
+        SPI_Send((page+pos)>>8);
+        SPI_Send((page+pos)&0xFF);
+        started=true;
+      }
+      for (i=0;i<count;i++,pos++)
+      {
+        data=Patch_Apply(page+pos,Clone_Store[((token&CLONEKIND)==CLONECOPY)?ptr+i:ptr]);
+        if (write) SPI_Send(data);
+        else if (Page_Buff[pos]!=data) Verify_Mismatch(page+pos,data,Page_Buff[pos]);
+      }
+      ptr+=((token&CLONEKIND)==CLONECOPY)?count:1;
+    }
+    if (started)
+    {
+      ProgDelayStop();
+      CmdPollPage();
+    }
+  }
+}
+
+//Empties the store for U with the line held off
+void Clone_Erase()
+{
+  unsigned long rx;
+  int i;
+  UART_XOff();
+  rx=UART_WaitQuiet();
+  for (i=0;i<CLONESTORESIZE;i+=CLONESEGMENTSIZE) Flash_Erase(i);
+  if ((rx!=Stats_RxBytes)||(UC0IFG&UCA0RXIFG)) Fault_Post(FAULT_RX_FLASH);
+  Clone_Ptr=CLONEHEADERSIZE;
+  Clone_Index=CLONESTORESIZE;
+  Clone_Page=CLONENOPAGE;
+  Page_Valid=false;//Page_Buff holds the page being stored
+  UART_XOn();
+}
+
+//Collects a record into the page being assembled in Page_Buff, storing
+//that page first when the record moves on to another. Returns false when
+//the store is full.
+bool Clone_Append(unsigned int address, unsigned char *data, int count)
+{
+  int i;
+  while (count--)
+  {
+    if ((address&~(Device->page_size-1))!=Clone_Page)
+    {
+      if (!Clone_Flush()) return false;
+      for (i=0;i<Device->page_size;i++) Page_Buff[i]=0xFF;
+      Clone_Page=address&~(Device->page_size-1);
+    }
+    Page_Buff[address&(Device->page_size-1)]=*data++;
+    address++;
+  }
+  return true;
+}
+
+//Compresses the page in Page_Buff into the store and indexes it. A blank
+//page stores nothing. Returns false when the store is full.
+bool Clone_Flush()
+{
+  unsigned char token,entry[CLONEINDEXSIZE];
+  int i,j,count,last;
+  unsigned int start=Clone_Ptr;
+  unsigned long rx;
+
+  if (Clone_Page==CLONENOPAGE) return true;
+  for (last=Device->page_size;(last>0)&&(Page_Buff[last-1]==0xFF);last--);
+  if (last==0)
+  {
+    Clone_Page=CLONENOPAGE;
+    return true;
+  }
+  //Worst case is one literal token for the page plus its end byte, and an
+  //erased index entry must stay below the new one to end the index
+  if (Clone_Ptr+Device->page_size+2+2*CLONEINDEXSIZE>Clone_Index) return false;
+
+  //The CPU stalls during flash writes, so the line must be idle
+  UART_XOff();
+  rx=UART_WaitQuiet();
+  for (i=0;i<last;i+=count)
+  {
+    for (count=1;(i+count<last)&&(count<64)&&(Page_Buff[i+count]==Page_Buff[i]);count++);
+    if (Page_Buff[i]==0xFF) token=CLONESKIP;
+    else if (count>=3) token=CLONEREPEAT;
+    else
+    {
+      //Literal up to the next blank pair or run of three
+      for (count=1;(i+count<last)&&(count<64);count++)
+      {
+        j=i+count;
+        if ((Page_Buff[j]==0xFF)&&(Page_Buff[j+1]==0xFF)) break;
+        if ((j+2<last)&&(Page_Buff[j]==Page_Buff[j+1])&&(Page_Buff[j]==Page_Buff[j+2])) break;
+      }
+      token=CLONECOPY;
+    }
+    token|=count-1;
+    Flash_Write(Clone_Ptr++,&token,1);
+    if ((token&CLONEKIND)==CLONECOPY)
+    {
+      Flash_Write(Clone_Ptr,Page_Buff+i,count);
+      Clone_Ptr+=count;
+    }
+    else if ((token&CLONEKIND)==CLONEREPEAT) Flash_Write(Clone_Ptr++,Page_Buff+i,1);
+  }
+  Clone_Ptr++;//Left erased to end the page
+
+  Clone_Index-=CLONEINDEXSIZE;
+  entry[0]=Clone_Page>>8;
+  entry[1]=Clone_Page&0xFF;
+  entry[2]=start>>8;
+  entry[3]=start&0xFF;
+  Flash_Write(Clone_Index,entry,CLONEINDEXSIZE);
+  Clone_Page=CLONENOPAGE;
+  if ((rx!=Stats_RxBytes)||(UC0IFG&UCA0RXIFG)) Fault_Post(FAULT_RX_FLASH);
+  UART_XOn();
+  return true;
+}
+
+//Main loop only. The timestamp is a mask of TA0R, no shifts; only the
+//rare wrap entry shifts its count into place. tools/tracejson.c unwraps.
+void Trace_Log(unsigned char event)
+{
+  unsigned long now;
+  unsigned int wraps;
+  if (Trace_Hold) return;
+  now=Timer_Now();
+  wraps=(now>>16)-Trace_Wraps;
+  if (wraps)
+  {
+    Trace_Wraps+=wraps;
+    if (wraps>0xFFF) wraps=0xFFF;
+    Trace_Put((wraps<<4)|TRACE_WRAP);
+  }
+  Trace_Put(((unsigned int)now&0xFFF0)|event);
+}
+
+//Logs a page write, first releasing the ring if it starts the armed range
+void Trace_Write(unsigned int address)
+{
+  if ((Trace_Start)&&(address>=Trace_Start))
+  {
+    Trace_Start=0;
+    Trace_Once=true;
+    Trace_Wraps=Timer_Now()>>16;
+    Trace_Hold=false;
+  }
+  Trace_Log(TRACE_CMD_WRITE);
+}
+
+//A stall within a millisecond of the end of one on the same ring, like a
+//message through the TX ring, takes back that end entry so the two log as
+//one. Returns false when the stall needs logging as new. The SPI ring is
+//left out: it drains faster than the main loop fills it, and SPI_Send is
+//on the deepest stack path.
+bool Trace_Reopen(unsigned char event)
+{
+  unsigned long now=Timer_Now();
+  unsigned int last=Trace_Buff[(Trace_Ptr-1)&(TRACEBUFFERSIZE-1)];
+  if ((Trace_Hold)||(Trace_Count<2)||((last&0x0F)!=TRACE_STALLDONE)) return false;
+  if ((Trace_Buff[(Trace_Ptr-2)&(TRACEBUFFERSIZE-1)]&0x0F)!=event) return false;
+  if (((now>>16)!=Trace_Wraps)||((unsigned int)now-(last&0xFFF0)>=TIMER_MS)) return false;
+  Trace_Ptr=(Trace_Ptr-1)&(TRACEBUFFERSIZE-1);
+  Trace_Count--;
+  return true;
+}
+
+void Trace_Put(unsigned int entry)
+{
+  Trace_Buff[Trace_Ptr]=entry;
+  Trace_Ptr=(Trace_Ptr+1)&(TRACEBUFFERSIZE-1);
+  if (Trace_Count<TRACEBUFFERSIZE) Trace_Count++;
+  if ((Trace_Once)&&(Trace_Count==TRACEBUFFERSIZE)) Trace_Hold=true;
+}
+
+//Oldest first, as TTTE words. Clears the ring and restarts tracing, at
+//once or, with a start address, from the first page write reaching it.
+void Trace_Dump(unsigned int start)
+{
+  int i,j;
+  Trace_Hold=true;
+  UART_Text("TRACE ");
+  UART_Hex(Trace_Count);
+  UART_Send(' ');
+  UART_Hex32(TIMER_HZ);
+  UART_Send(' ');
+  UART_Hex(TRACE_VERSION);
+  for (i=0;i<Trace_Count;i++)
+  {
+    j=(Trace_Ptr-Trace_Count+i)&(TRACEBUFFERSIZE-1);
+    if ((i&7)==0) UART_Text("\r\n");
+    else UART_Send(' ');
+    UART_Hex(Trace_Buff[j]>>8);
+    UART_Hex(Trace_Buff[j]&0xFF);
+  }
+  Trace_Ptr=0;
+  Trace_Count=0;
+  Trace_Wraps=Timer_Now()>>16;
+  Trace_Start=start;
+  Trace_Once=false;
+  Trace_Hold=(start!=0);
+}
@@ -0,0 +1,43 @@
+/**   AT89LP6440 Programmer trace format
+ *    Copyright (C) 2014 Joey Shepard
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+/*  Event codes shared by the firmware's trace ring and tools/tracejson.c.
+ *  T prints "TRACE <count> <timer hz> <version>" and then the entries as
+ *  4 hex digits each: the raw TA0R with the event in the low 4 bits. A
+ *  TRACE_WRAP entry holds the number of times TA0R wrapped since the entry
+ *  before it in its upper 12 bits. Bump TRACE_VERSION whenever a code or
+ *  its meaning changes so old captures are refused rather than misread.
+**/
+
+#ifndef AT89_TRACE_H
+#define AT89_TRACE_H
+
+#define TRACE_VERSION       2
+
+#define TRACE_BUSYDONE      0x04
+#define TRACE_XOFF          0x05
+#define TRACE_XON           0x06
+#define TRACE_TXSTALL       0x07
+#define TRACE_SPISTALL      0x08
+#define TRACE_STALLDONE     0x09
+#define TRACE_CMD_READ      0x0A//One entry per SPI command, as its opcode goes out
+#define TRACE_CMD_WRITE     0x0B
+#define TRACE_CMD_STATUS    0x0C
+#define TRACE_CMD_ERASE     0x0D
+#define TRACE_WRAP          0x0F
+
+#endif
@@ -0,0 +1,261 @@
+/**   AT89LP6440 Programmer host simulator
+ *    Copyright (C) 2014 Joey Shepard
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+/*  Runs E, L and V against the simulated target for every image size,
+ *  page density and record length in the matrix and prints one JSON line
+ *  per run with simulated times, effective rates, link utilization and the
+ *  firmware's own B counters for the load. The baud rate is the one the
+ *  firmware programs, so sim/bench.sh builds one binary per rate.
+ *
+ *  bench [-s size] [-d density] [-r reclen] [-w write_us] [-e erase_us]
+ *        [-x xoff_us] [-c access_cycles]
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define PAGESIZE  64
+#define TIMEOUT_S 1000
+
+//Firmware counters, in Timer_A ticks where they are times
+#define FW_HZ     2000000.0
+extern volatile unsigned long Stats_RxBytes;
+extern unsigned long Stats_Xoff;
+extern unsigned long Stats_Busy;
+extern unsigned long Stats_TxStall;
+extern unsigned long Stats_SpiStall;
+extern volatile int Stats_RxHigh;
+extern volatile unsigned char Fault_Counts[];
+
+typedef struct
+{
+  SimTime start,end;
+  SimStats sim;
+  unsigned long rx,xoff,busy,txstall,spistall,drop,oe;
+} Phase;
+
+unsigned char Image[0x10000];
+char *Hex;
+size_t HexLen,HexSize;
+int Records,DataBytes;
+
+char *Output;
+size_t OutputLen,OutputSize;
+int Step;
+Phase Phases[3];
+const char *Commands[3]={"E\r","L\r","V\r"};
+
+void Append(char **buff, size_t *len, size_t *size, const char *text, size_t count)
+{
+  if (*len+count+1>*size)
+  {
+    *size=(*len+count+1)*2;
+    *buff=realloc(*buff,*size);
+    if (!*buff)
+    {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  memcpy(*buff+*len,text,count);
+  *len+=count;
+  (*buff)[*len]=0;
+}
+
+void Record(unsigned int address, unsigned char type, unsigned char *data, int len)
+{
+  char text[16];
+  unsigned char crc;
+  int i;
+  crc=len+(address>>8)+(address&0xFF)+type;
+  Append(&Hex,&HexLen,&HexSize,text,sprintf(text,":%02X%04X%02X",len,address,type));
+  for (i=0;i<len;i++)
+  {
+    Append(&Hex,&HexLen,&HexSize,text,sprintf(text,"%02X",data[i]));
+    crc+=data[i];
+  }
+  Append(&Hex,&HexLen,&HexSize,text,sprintf(text,"%02X\r\n",(unsigned char)-crc));
+}
+
+//Pages carry data with the given probability and are sent in hexpack -r
+//order, blank pages dropped
+void MakeImage(unsigned int size, double density, int reclen)
+{
+  unsigned int page,i;
+  memset(Image,0xFF,sizeof(Image));
+  HexLen=0;
+  Records=0;
+  DataBytes=0;
+  for (page=0;page<size;page+=PAGESIZE)
+  {
+    if (Sim_Random(1000000)>=density*1000000) continue;
+    for (i=0;i<PAGESIZE;i++) Image[page+i]=Sim_Random(255);
+    for (i=0;i<PAGESIZE;i+=reclen)
+    {
+      Record(page+i,0,Image+page+i,reclen);
+      Records++;
+      DataBytes+=reclen;
+    }
+  }
+  Record(0,1,0,0);
+}
+
+void Snapshot(Phase *phase, bool end)
+{
+  Phase now;
+  now.sim=Sim_Stats;
+  now.rx=Stats_RxBytes;
+  now.xoff=Stats_Xoff;
+  now.busy=Stats_Busy;
+  now.txstall=Stats_TxStall;
+  now.spistall=Stats_SpiStall;
+  now.drop=Fault_Counts[0];
+  now.oe=Fault_Counts[1];
+  if (!end)
+  {
+    *phase=now;
+    phase->start=Sim_Now;
+    Stats_RxHigh=0;
+    return;
+  }
+  phase->end=Sim_Now;
+  phase->sim.host_sent=now.sim.host_sent-phase->sim.host_sent;
+  phase->sim.host_paused=now.sim.host_paused-phase->sim.host_paused;
+  phase->sim.target_busy=now.sim.target_busy-phase->sim.target_busy;
+  phase->sim.violations=now.sim.violations-phase->sim.violations;
+  phase->sim.overruns=now.sim.overruns-phase->sim.overruns;
+  phase->rx=now.rx-phase->rx;
+  phase->xoff=now.xoff-phase->xoff;
+  phase->busy=now.busy-phase->busy;
+  phase->txstall=now.txstall-phase->txstall;
+  phase->spistall=now.spistall-phase->spistall;
+  phase->drop=now.drop-phase->drop;
+  phase->oe=now.oe-phase->oe;
+}
+
+//A prompt after the last command ends its phase and starts the next
+void OnOutput(unsigned char data)
+{
+  char c=data;
+  if ((data==0x11)||(data==0x13)) return;
+  Append(&Output,&OutputLen,&OutputSize,&c,1);
+  if ((OutputLen<3)||(strcmp(Output+OutputLen-3,"\r\n>"))) return;
+
+  if (Step>0) Snapshot(&Phases[Step-1],true);
+  if (Step==3) Sim_Stop(0);
+  OutputLen=0;
+  Snapshot(&Phases[Step],false);
+  Sim_HostSend(Commands[Step],2);
+  if (Step>0) Sim_HostSend(Hex,HexLen);
+  Step++;
+}
+
+void PrintPhase(const char *name, Phase *phase, unsigned long baud, int bytes, bool last)
+{
+  double t=(phase->end-phase->start)/(double)SIM_HZ;
+  printf("\"%s\":{\"s\":%.6f,\"bytes_per_s\":%.1f,\"link_util\":%.4f,\"host_paused_s\":%.6f,"
+    "\"target_busy_s\":%.6f,\"fw_rx\":%lu,\"fw_xoff_s\":%.6f,\"fw_busy_s\":%.6f,\"fw_txstall_s\":%.6f,"
+    "\"fw_spistall_s\":%.6f,\"drop\":%lu,\"oe\":%lu,\"violations\":%lu}%s",
+    name,t,t>0?bytes/t:0,t>0?phase->sim.host_sent*10.0/(baud*t):0,
+    phase->sim.host_paused/(double)SIM_HZ,phase->sim.target_busy/(double)SIM_HZ,
+    phase->rx,phase->xoff/FW_HZ,phase->busy/FW_HZ,phase->txstall/FW_HZ,phase->spistall/FW_HZ,
+    phase->drop,phase->oe,phase->sim.violations,last?"":",");
+}
+
+int Run(unsigned int size, double density, int reclen)
+{
+  char *verify;
+  int code;
+  bool programmed;
+
+  Sim_Config.seed=size^reclen^(unsigned int)(density*1000);
+  Sim_Reset();
+  MakeImage(size,density,reclen);
+  Firmware_Init();
+  Sim_OnOutput=OnOutput;
+  Step=0;
+  OutputLen=0;
+  code=Sim_Run(Firmware_Main);
+
+  verify=(OutputLen)?strstr(Output,"VERIFYING DONE"):0;
+  programmed=!memcmp(Image,Sim_TargetFlash,sizeof(Image));
+  printf("{\"baud\":%lu,\"size\":%u,\"density\":%.2f,\"reclen\":%d,\"records\":%d,\"data_bytes\":%d,"
+    "\"hex_bytes\":%lu,\"ok\":%s,\"programmed\":%s,\"verified\":%s,",
+    Sim_Baud(),size,density,reclen,Records,DataBytes,(unsigned long)HexLen,
+    code==0?"true":"false",programmed?"true":"false",verify?"true":"false");
+  PrintPhase("erase",&Phases[0],Sim_Baud(),0,false);
+  PrintPhase("load",&Phases[1],Sim_Baud(),DataBytes,false);
+  PrintPhase("verify",&Phases[2],Sim_Baud(),DataBytes,true);
+  printf("}\n");
+  fflush(stdout);
+  return (code==0)&&(programmed)&&(verify);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned int sizes[3]={2048,8192,32768};
+  double densities[3]={1.0,0.5,0.1};
+  int reclens[3]={16,32,64};
+  int size_count=3,density_count=3,reclen_count=3,i,j,k,failed=0;
+
+  Sim_Config.access_cycles=4;
+  Sim_Config.write_us=2500;//Assumed AT89LP page write time
+  Sim_Config.erase_us=20000;//Assumed chip erase time
+  Sim_Config.timeout_s=TIMEOUT_S;
+
+  for (i=1;i<argc;i++)
+  {
+    if ((!strcmp(argv[i],"-s"))&&(i+1<argc))
+    {
+      sizes[0]=strtoul(argv[++i],0,0);
+      size_count=1;
+    }
+    else if ((!strcmp(argv[i],"-d"))&&(i+1<argc))
+    {
+      densities[0]=atof(argv[++i]);
+      density_count=1;
+    }
+    else if ((!strcmp(argv[i],"-r"))&&(i+1<argc))
+    {
+      reclens[0]=strtol(argv[++i],0,0);
+      reclen_count=1;
+    }
+    else if ((!strcmp(argv[i],"-w"))&&(i+1<argc)) Sim_Config.write_us=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-e"))&&(i+1<argc)) Sim_Config.erase_us=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-x"))&&(i+1<argc)) Sim_Config.xoff_us=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-c"))&&(i+1<argc)) Sim_Config.access_cycles=strtoul(argv[++i],0,0);
+    else
+    {
+      fprintf(stderr,"usage: bench [-s size] [-d density] [-r reclen] [-w write_us] [-e erase_us] [-x xoff_us] [-c access_cycles]\n");
+      return 1;
+    }
+  }
+  if ((sizes[0]>0x10000)||(sizes[0]%PAGESIZE)||(reclens[0]<1)||(reclens[0]>PAGESIZE)||(PAGESIZE%reclens[0]))
+  {
+    fprintf(stderr,"size must be a multiple of %d up to 64K and reclen divide %d\n",PAGESIZE,PAGESIZE);
+    return 1;
+  }
+
+  for (i=0;i<size_count;i++)
+    for (j=0;j<density_count;j++)
+      for (k=0;k<reclen_count;k++)
+        if (!Run(sizes[i],densities[j],reclens[k])) failed++;
+  return failed?1:0;
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Builds the simulator once per baud rate and runs the bench matrix on each,
+# printing one JSON line per run. Extra arguments go to every bench run.
+#
+#   sim/bench.sh [bench options] > bench.json
+
+cd "$(dirname "$0")/.." || exit 1
+out=${TMPDIR:-/tmp}/at89sim.$$
+mkdir -p "$out" || exit 1
+trap 'rm -rf "$out"' EXIT
+
+status=0
+# name UART_BR UART_BRS, the UCA0BR and UCBRS values for a 16MHz SMCLK
+for rate in "19200 0x341 3" "57600 0x115 6" "115200 0x8A 7"
+do
+  set -- $rate "$@"
+  baud=$1 br=$2 brs=$3
+  shift 3
+  ${CC:-cc} -O2 -Isim -DUART_BR="$br" -DUART_BRS="$brs" -o "$out/bench$baud" \
+    sim/bench.c sim/sim.c sim/firmware.c || exit 1
+  "$out/bench$baud" "$@" || status=1
+done
+exit $status
@@ -0,0 +1,98 @@
+/**   AT89LP6440 Programmer host simulator
+ *    Copyright (C) 2014 Joey Shepard
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+/*  The unmodified firmware, built for the host against msp430.h. The RAM
+ *  variables the main loop spins on are routed through accessors so a busy
+ *  wait on them lets simulated time pass, the same as a register poll.
+**/
+
+#include "sim.h"
+
+#define main Firmware_Main
+#define UART_RxCount      (*Sim_UART_RxCount())
+#define UART_RingCount    (*Sim_UART_RingCount())
+#define SPI_RingCount     (*Sim_SPI_RingCount())
+#define SPI_ReceiveCount  (*Sim_SPI_ReceiveCount())
+#define SPI_SendStop      (*Sim_SPI_SendStop())
+
+volatile int *Sim_UART_RxCount();
+volatile int *Sim_UART_RingCount();
+volatile int *Sim_SPI_RingCount();
+volatile int *Sim_SPI_ReceiveCount();
+volatile bool *Sim_SPI_SendStop();
+
+#include "../AT89_Programmer.c"
+
+#undef UART_RxCount
+#undef UART_RingCount
+#undef SPI_RingCount
+#undef SPI_ReceiveCount
+#undef SPI_SendStop
+
+const int Firmware_RxRing=UARTRXBUFFERSIZE;
+const int Firmware_TxRing=RINGBUFFERSIZE;
+const int Firmware_SpiRing=SPIBUFFERSIZE;
+
+static volatile int UART_RxCount,UART_RingCount,SPI_RingCount,SPI_ReceiveCount;
+static volatile bool SPI_SendStop,InIdle;
+
+//An empty RX ring read from outside an ISR is the firmware waiting for input
+volatile int *Sim_UART_RxCount()
+{
+  Sim_Tick();
+  if ((!UART_RxCount)&&(Sim_OnIdle)&&(!InIdle)&&(!Sim_InIsr()))
+  {
+    InIdle=true;
+    Sim_OnIdle();
+    InIdle=false;
+  }
+  return &UART_RxCount;
+}
+
+volatile int *Sim_UART_RingCount()
+{
+  Sim_Tick();
+  return &UART_RingCount;
+}
+
+volatile int *Sim_SPI_RingCount()
+{
+  Sim_Tick();
+  return &SPI_RingCount;
+}
+
+volatile int *Sim_SPI_ReceiveCount()
+{
+  Sim_Tick();
+  return &SPI_ReceiveCount;
+}
+
+volatile bool *Sim_SPI_SendStop()
+{
+  Sim_Tick();
+  return &SPI_SendStop;
+}
+
+//A run stopped from inside Sim_OnIdle never unwinds back to clear InIdle
+void Firmware_Init()
+{
+  InIdle=false;
+  Sim_Flash(Clone_Image,sizeof(Clone_Image));
+  Sim_Vector[TIMER0_A1_VECTOR]=TIMER0_A1_ISR;
+  Sim_Vector[USCIAB0RX_VECTOR]=USCI0RX_ISR;
+  Sim_Vector[USCIAB0TX_VECTOR]=USCI0TX_ISR;
+}
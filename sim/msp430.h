@@ -0,0 +1,141 @@
+/**   AT89LP6440 Programmer host simulator
+ *    Copyright (C) 2014 Joey Shepard
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+/*  Stand in for the MSP430G2553 header when the firmware is built on the
+ *  host. Every register access goes through Sim_Reg(), which advances
+ *  simulated time, runs the peripheral models and dispatches interrupts.
+ *  Bit values match the real header.
+**/
+
+#ifndef SIM_MSP430_H
+#define SIM_MSP430_H
+
+enum
+{
+  SIM_WDTCTL,SIM_BCSCTL1,SIM_DCOCTL,SIM_CALBC1_16MHZ,SIM_CALDCO_16MHZ,
+  SIM_P1OUT,SIM_P1DIR,SIM_P1IN,SIM_P1SEL,SIM_P1SEL2,
+  SIM_P2OUT,SIM_P2DIR,SIM_P2IN,SIM_P2SEL,SIM_P2SEL2,SIM_P2REN,
+  SIM_UC0IE,SIM_UC0IFG,
+  SIM_UCA0CTL0,SIM_UCA0CTL1,SIM_UCA0BR0,SIM_UCA0BR1,SIM_UCA0MCTL,SIM_UCA0STAT,SIM_UCA0RXBUF,SIM_UCA0TXBUF,
+  SIM_UCB0CTL0,SIM_UCB0CTL1,SIM_UCB0BR0,SIM_UCB0BR1,SIM_UCB0STAT,SIM_UCB0RXBUF,SIM_UCB0TXBUF,
+  SIM_TA0CTL,SIM_TA0R,SIM_TA0IV,
+  SIM_FCTL1,SIM_FCTL2,SIM_FCTL3,
+  SIM_REGISTERS
+};
+
+volatile unsigned int *Sim_Reg(int reg);
+void Sim_Delay(unsigned long cycles);
+void Sim_Interrupts(int enable);
+
+#define WDTCTL          (*Sim_Reg(SIM_WDTCTL))
+#define BCSCTL1         (*Sim_Reg(SIM_BCSCTL1))
+#define DCOCTL          (*Sim_Reg(SIM_DCOCTL))
+#define CALBC1_16MHZ    (*Sim_Reg(SIM_CALBC1_16MHZ))
+#define CALDCO_16MHZ    (*Sim_Reg(SIM_CALDCO_16MHZ))
+#define P1OUT           (*Sim_Reg(SIM_P1OUT))
+#define P1DIR           (*Sim_Reg(SIM_P1DIR))
+#define P1IN            (*Sim_Reg(SIM_P1IN))
+#define P1SEL           (*Sim_Reg(SIM_P1SEL))
+#define P1SEL2          (*Sim_Reg(SIM_P1SEL2))
+#define P2OUT           (*Sim_Reg(SIM_P2OUT))
+#define P2DIR           (*Sim_Reg(SIM_P2DIR))
+#define P2IN            (*Sim_Reg(SIM_P2IN))
+#define P2SEL           (*Sim_Reg(SIM_P2SEL))
+#define P2SEL2          (*Sim_Reg(SIM_P2SEL2))
+#define P2REN           (*Sim_Reg(SIM_P2REN))
+#define UC0IE           (*Sim_Reg(SIM_UC0IE))
+#define UC0IFG          (*Sim_Reg(SIM_UC0IFG))
+#define UCA0CTL0        (*Sim_Reg(SIM_UCA0CTL0))
+#define UCA0CTL1        (*Sim_Reg(SIM_UCA0CTL1))
+#define UCA0BR0         (*Sim_Reg(SIM_UCA0BR0))
+#define UCA0BR1         (*Sim_Reg(SIM_UCA0BR1))
+#define UCA0MCTL        (*Sim_Reg(SIM_UCA0MCTL))
+#define UCA0STAT        (*Sim_Reg(SIM_UCA0STAT))
+#define UCA0RXBUF       (*Sim_Reg(SIM_UCA0RXBUF))
+#define UCA0TXBUF       (*Sim_Reg(SIM_UCA0TXBUF))
+#define UCB0CTL0        (*Sim_Reg(SIM_UCB0CTL0))
+#define UCB0CTL1        (*Sim_Reg(SIM_UCB0CTL1))
+#define UCB0BR0         (*Sim_Reg(SIM_UCB0BR0))
+#define UCB0BR1         (*Sim_Reg(SIM_UCB0BR1))
+#define UCB0STAT        (*Sim_Reg(SIM_UCB0STAT))
+#define UCB0RXBUF       (*Sim_Reg(SIM_UCB0RXBUF))
+#define UCB0TXBUF       (*Sim_Reg(SIM_UCB0TXBUF))
+#define TA0CTL          (*Sim_Reg(SIM_TA0CTL))
+#define TA0R            (*Sim_Reg(SIM_TA0R))
+#define TA0IV           (*Sim_Reg(SIM_TA0IV))
+#define FCTL1           (*Sim_Reg(SIM_FCTL1))
+#define FCTL2           (*Sim_Reg(SIM_FCTL2))
+#define FCTL3           (*Sim_Reg(SIM_FCTL3))
+
+#define BIT0            0x0001
+#define BIT1            0x0002
+#define BIT2            0x0004
+#define BIT3            0x0008
+#define BIT4            0x0010
+#define BIT5            0x0020
+#define BIT6            0x0040
+#define BIT7            0x0080
+
+#define WDTPW           0x5A00
+#define WDTHOLD         0x0080
+
+#define UCA0RXIE        0x01
+#define UCA0TXIE        0x02
+#define UCB0RXIE        0x04
+#define UCB0TXIE        0x08
+#define UCA0RXIFG       0x01
+#define UCA0TXIFG       0x02
+#define UCB0RXIFG       0x04
+#define UCB0TXIFG       0x08
+
+#define UCSWRST         0x01
+#define UCSSEL_2        0x80
+#define UCSYNC          0x01
+#define UCMST           0x08
+#define UCMSB           0x20
+#define UCCKPH          0x80
+#define UCBRS_3         0x06
+#define UCBRS_6         0x0C
+#define UCBRF_0         0x00
+#define UCBUSY          0x01
+#define UCOE            0x20
+
+#define TAIFG           0x0001
+#define TAIE            0x0002
+#define TACLR           0x0004
+#define MC_2            0x0020
+#define ID_3            0x00C0
+#define TASSEL_2        0x0200
+#define TA0IV_TAIFG     0x000A
+
+#define FWKEY           0xA500
+#define ERASE           0x0002
+#define WRT             0x0040
+#define BUSY            0x0001
+#define LOCK            0x0010
+#define FSSEL_1         0x0040
+
+#define TIMER0_A1_VECTOR  0
+#define USCIAB0RX_VECTOR  1
+#define USCIAB0TX_VECTOR  2
+#define interrupt(vector) used//Plain functions, called by the simulator
+
+#define __enable_interrupt()  Sim_Interrupts(1)
+#define __disable_interrupt() Sim_Interrupts(0)
+#define __delay_cycles(n)     Sim_Delay(n)
+
+#endif
@@ -0,0 +1,632 @@
+/**   AT89LP6440 Programmer host simulator
+ *    Copyright (C) 2014 Joey Shepard
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+/*  Register and peripheral models behind msp430.h.
+ *
+ *  Stores to TXBUF and P1OUT land in plain storage after Sim_Reg returns,
+ *  so every access first picks up what the previous one wrote. A TXBUF
+ *  holds SIM_EMPTY until the firmware writes it. Interrupts are taken
+ *  between accesses, highest priority first, never nested.
+ *
+ *  The flash region given to Sim_Flash is kept read only. A store to it
+ *  traps, lands with the page briefly writable and is settled at the next
+ *  access the way the controller would: segment erase or AND into the old
+ *  byte per FCTL1, or dropped while LOCK is set. FCTL3 then reads BUSY for
+ *  the erase or byte program time at the FCTL2 clock, and the CPU takes no
+ *  interrupts until it clears.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "msp430.h"
+#include "sim.h"
+
+#define SIM_EMPTY         0x100
+#define SIM_NEVER         (~0ULL)
+#define SIM_ISR_CYCLES    11//6 to enter, 5 to return
+#define SIM_SS            BIT3
+#define SIM_RST           BIT3
+#define SIM_FLASHSEGMENT  512
+#define SIM_FLASHERASE    4819//Segment erase, in flash timing generator clocks
+#define SIM_FLASHBYTE     30//Byte program
+
+SimConfig Sim_Config;
+SimStats Sim_Stats;
+SimTime Sim_Now;
+
+unsigned char Sim_TargetFlash[0x10000];
+unsigned char Sim_TargetFuses[16];
+unsigned char Sim_TargetLocks[2];
+unsigned char Sim_TargetSignature[3];
+unsigned int Sim_TargetPageSize;
+bool Sim_TargetPresent;
+unsigned char Sim_P2Low;
+SimTime Sim_P2LowFrom,Sim_P2LowUntil;
+
+void (*Sim_Vector[3])(void);
+
+void (*Sim_OnOutput)(unsigned char data);
+void (*Sim_OnIdle)(void);
+
+static volatile unsigned int Reg[SIM_REGISTERS];
+static bool Gie,InIsr;
+static jmp_buf Exit;
+static int StopCode;
+static unsigned long Seed;
+
+//USCI_A0 and the host on the other end of the line
+static SimTime UartTxDone=SIM_NEVER;
+static int UartTxShift,UartTxBuff=-1;
+static unsigned char *HostQueue;
+static size_t HostQueueSize,HostQueueHead,HostQueueTail;
+static SimTime HostRxDone=SIM_NEVER,HostNextAllowed,HostPauseAt=SIM_NEVER,HostPauseStart;
+static unsigned char HostRxByte;
+static bool HostPaused;
+static unsigned int HostBurstLeft;
+
+//USCI_B0 and the target
+static SimTime SpiDone=SIM_NEVER;
+static int SpiShift,SpiBuff=-1;
+static unsigned int LastP1;
+static unsigned int TargetIndex,TargetAddress;
+static unsigned char TargetCommand,TargetPage[0x100];
+static bool TargetLoaded[0x100],TargetIgnore;
+static SimTime TargetBusyUntil;
+
+static SimTime TimerOverflow;
+
+//MSP430 flash and its controller
+static unsigned char *FlashBase,*FlashPending;
+static size_t FlashSize;
+static unsigned char FlashOld;
+static SimTime FlashBusyUntil;
+
+static void Dispatch();
+
+unsigned long Sim_Random(unsigned long range)
+{
+  if (range==0) return 0;
+  Seed=Seed*6364136223846793005ULL+1442695040888963407ULL;
+  return (Seed>>33)%range;
+}
+
+static SimTime UartByte()
+{
+  unsigned int br,brs;
+  if (Sim_Config.baud) return (SIM_HZ*10+Sim_Config.baud/2)/Sim_Config.baud;
+  br=Reg[SIM_UCA0BR0]+Reg[SIM_UCA0BR1]*256;
+  brs=(Reg[SIM_UCA0MCTL]>>1)&7;
+  return (10*(br*8+brs)+4)/8;
+}
+
+unsigned long Sim_Baud()
+{
+  if (Sim_Config.baud) return Sim_Config.baud;
+  return SIM_HZ*8/((Reg[SIM_UCA0BR0]+Reg[SIM_UCA0BR1]*256)*8+((Reg[SIM_UCA0MCTL]>>1)&7));
+}
+
+static SimTime SpiByte()
+{
+  return 8*(Reg[SIM_UCB0BR0]+Reg[SIM_UCB0BR1]*256)+Sim_Random(Sim_Config.spi_jitter+1);
+}
+
+//Host transmit: the line idles while paused, between bursts or when out of data
+static void HostStart()
+{
+  SimTime t=Sim_Now;
+  if ((HostRxDone!=SIM_NEVER)||(HostPaused)||(HostQueueHead==HostQueueTail)) return;
+  if (HostNextAllowed>t) t=HostNextAllowed;
+  HostRxByte=HostQueue[HostQueueHead++];
+  HostRxDone=t+UartByte();
+}
+
+static void HostByteSent()
+{
+  HostRxDone=SIM_NEVER;
+  Sim_Stats.host_sent++;
+  if ((Sim_Config.burst_max)&&(--HostBurstLeft==0))
+  {
+    HostBurstLeft=1+Sim_Random(Sim_Config.burst_max);
+    HostNextAllowed=Sim_Now+Sim_Random(Sim_Config.gap_max_us*SIM_US+1);
+  }
+  //The MSP430 side of the same byte
+  if (Reg[SIM_UC0IFG]&UCA0RXIFG)
+  {
+    Reg[SIM_UCA0STAT]|=UCOE;
+    Sim_Stats.overruns++;
+  }
+  Reg[SIM_UCA0RXBUF]=HostRxByte;
+  Reg[SIM_UC0IFG]|=UCA0RXIFG;
+}
+
+static void HostReceive(unsigned char data)
+{
+  Sim_Stats.host_received++;
+  if (data==0x13)
+  {
+    if ((!HostPaused)&&(HostPauseAt==SIM_NEVER))
+    {
+      HostPauseAt=Sim_Now+(Sim_Config.xoff_us+Sim_Random(Sim_Config.xoff_jitter_us+1))*SIM_US;
+    }
+  }
+  else if (data==0x11)
+  {
+    HostPauseAt=SIM_NEVER;
+    if (HostPaused)
+    {
+      HostPaused=false;
+      Sim_Stats.host_paused+=Sim_Now-HostPauseStart;
+    }
+  }
+  if (Sim_OnOutput) Sim_OnOutput(data);
+}
+
+//Target side of one SPI byte: the reply is what the target drives while
+//the byte shifts in, so it depends only on the bytes before it
+static unsigned char TargetExchange(unsigned char in)
+{
+  unsigned char out=0xFF;
+  unsigned int i=TargetIndex++;
+  bool busy=Sim_Now<TargetBusyUntil;
+
+  if ((!Sim_TargetPresent)||(Reg[SIM_P2OUT]&SIM_RST)||(TargetIgnore)) return 0xFF;
+  if (i==0) TargetIgnore=(in!=0xAA);
+  else if (i==1) TargetIgnore=(in!=0x55);
+  else if (i==2)
+  {
+    TargetCommand=in;
+    if ((busy)&&(in!=0x60))
+    {
+      Sim_Stats.violations++;
+      TargetIgnore=true;
+    }
+  }
+  else if (i==3) TargetAddress=in*256;
+  else if (i==4)
+  {
+    TargetAddress+=in;
+    if (TargetCommand==0xAC) out=0x53;
+  }
+  if (i<5) return out;
+
+  switch (TargetCommand)
+  {
+    case 0x30://Read page, wraps within the page
+      out=Sim_TargetFlash[TargetAddress];
+      TargetAddress=(TargetAddress&~(Sim_TargetPageSize-1))|((TargetAddress+1)&(Sim_TargetPageSize-1));
+      break;
+    case 0x38:
+      out=(i-5<3)?Sim_TargetSignature[i-5]:0xFF;
+      break;
+    case 0x50:
+      TargetPage[TargetAddress&(Sim_TargetPageSize-1)]=in;
+      TargetLoaded[TargetAddress&(Sim_TargetPageSize-1)]=true;
+      TargetAddress=(TargetAddress&~(Sim_TargetPageSize-1))|((TargetAddress+1)&(Sim_TargetPageSize-1));
+      break;
+    case 0x60:
+      out=busy?0x00:0x01;
+      break;
+    case 0x61:
+      out=(i-5<sizeof(Sim_TargetFuses))?Sim_TargetFuses[i-5]:0xFF;
+      break;
+    case 0x64:
+      out=(i-5<sizeof(Sim_TargetLocks))?Sim_TargetLocks[i-5]:0xFF;
+      break;
+    case 0xF1:
+      if (i-5<sizeof(Sim_TargetFuses)) TargetPage[i-5]=in;
+      break;
+    case 0xE4:
+      if (i-5<sizeof(Sim_TargetLocks)) TargetPage[i-5]=in;
+      break;
+  }
+  return out;
+}
+
+static void TargetBusy(unsigned long us)
+{
+  SimTime t=(us+Sim_Random(Sim_Config.busy_jitter_us+1))*SIM_US;
+  TargetBusyUntil=Sim_Now+t;
+  Sim_Stats.target_busy+=t;
+}
+
+//SS rising ends the command; writes start their busy time here
+static void TargetCommit()
+{
+  unsigned int i,base=TargetAddress&~(Sim_TargetPageSize-1);
+  if ((!Sim_TargetPresent)||(TargetIgnore)||(TargetIndex<3)) return;
+  switch (TargetCommand)
+  {
+    case 0x8A:
+      memset(Sim_TargetFlash,0xFF,sizeof(Sim_TargetFlash));
+      memset(Sim_TargetLocks,0xFF,sizeof(Sim_TargetLocks));
+      Sim_Stats.target_erases++;
+      TargetBusy(Sim_Config.erase_us);
+      break;
+    case 0x50:
+      if (TargetIndex<6) break;
+      for (i=0;i<Sim_TargetPageSize;i++) if (TargetLoaded[i]) Sim_TargetFlash[base+i]&=TargetPage[i];
+      Sim_Stats.target_writes++;
+      TargetBusy(Sim_Config.write_us);
+      break;
+    case 0xF1:
+      for (i=0;(i+5<TargetIndex)&&(i<sizeof(Sim_TargetFuses));i++) Sim_TargetFuses[i]=TargetPage[i];
+      TargetBusy(Sim_Config.write_us);
+      break;
+    case 0xE4:
+      for (i=0;(i+5<TargetIndex)&&(i<sizeof(Sim_TargetLocks));i++) Sim_TargetLocks[i]&=TargetPage[i];
+      TargetBusy(Sim_Config.write_us);
+      break;
+  }
+}
+
+static void SpiStart(unsigned char data)
+{
+  SpiShift=data;
+  SpiDone=Sim_Now+SpiByte();
+  Reg[SIM_UC0IFG]|=UCB0TXIFG;
+}
+
+static void SpiByteDone()
+{
+  SpiDone=SIM_NEVER;
+  if (Reg[SIM_UC0IFG]&UCB0RXIFG) Reg[SIM_UCB0STAT]|=UCOE;
+  Reg[SIM_UCB0RXBUF]=(Reg[SIM_P1OUT]&SIM_SS)?0xFF:TargetExchange(SpiShift);
+  Reg[SIM_UC0IFG]|=UCB0RXIFG;
+  if (SpiBuff>=0)
+  {
+    SpiStart(SpiBuff);
+    SpiBuff=-1;
+  }
+}
+
+static void UartStart(unsigned char data)
+{
+  UartTxShift=data;
+  UartTxDone=Sim_Now+UartByte();
+  Reg[SIM_UC0IFG]|=UCA0TXIFG;
+}
+
+static void UartByteDone()
+{
+  UartTxDone=SIM_NEVER;
+  HostReceive(UartTxShift);
+  if ((UartTxBuff>=0)&&(UartTxDone==SIM_NEVER))
+  {
+    UartStart(UartTxBuff);
+    UartTxBuff=-1;
+  }
+}
+
+static void FlashProtect(int prot)
+{
+  size_t page=sysconf(_SC_PAGESIZE);
+  unsigned char *start=(unsigned char *)((size_t)FlashBase&~(page-1));
+  if (mprotect(start,FlashBase+FlashSize-start,prot))
+  {
+    perror("mprotect");
+    exit(1);
+  }
+}
+
+//Settles a trapped store once the firmware has moved on
+static void FlashCommit()
+{
+  unsigned char data;
+  unsigned long clocks;
+  if (!FlashPending) return;
+  data=*FlashPending;
+  clocks=(Reg[SIM_FCTL2]&0x3F)+1;
+  if ((Reg[SIM_FCTL3]&LOCK)||(Sim_Now<FlashBusyUntil)||(!(Reg[SIM_FCTL1]&(ERASE|WRT))))
+  {
+    *FlashPending=FlashOld;
+    Sim_Stats.flash_violations++;
+  }
+  else if (Reg[SIM_FCTL1]&ERASE)
+  {
+    memset(FlashBase+((FlashPending-FlashBase)&~(SIM_FLASHSEGMENT-1)),0xFF,SIM_FLASHSEGMENT);
+    FlashBusyUntil=Sim_Now+SIM_FLASHERASE*clocks;
+  }
+  else if (Reg[SIM_FCTL1]&WRT)
+  {
+    *FlashPending=FlashOld&data;
+    if (*FlashPending!=data) Sim_Stats.flash_violations++;//Programming can only clear bits
+    FlashBusyUntil=Sim_Now+SIM_FLASHBYTE*clocks;
+  }
+  FlashPending=0;
+  FlashProtect(PROT_READ);
+}
+
+static void FlashTrap(int sig, siginfo_t *info, void *context)
+{
+  unsigned char *address=info->si_addr;
+  (void)context;
+  if ((!FlashBase)||(address<FlashBase)||(address>=FlashBase+FlashSize))
+  {
+    signal(sig,SIG_DFL);
+    raise(sig);
+    return;
+  }
+  FlashCommit();
+  FlashPending=address;
+  FlashOld=*address;
+  FlashProtect(PROT_READ|PROT_WRITE);//The store runs again on return
+}
+
+//Picks up stores made since the last access
+static void Sync()
+{
+  unsigned int p;
+  FlashCommit();
+  if (Reg[SIM_UCA0TXBUF]!=SIM_EMPTY)
+  {
+    Reg[SIM_UC0IFG]&=~UCA0TXIFG;
+    if (UartTxDone==SIM_NEVER) UartStart(Reg[SIM_UCA0TXBUF]&0xFF);
+    else UartTxBuff=Reg[SIM_UCA0TXBUF]&0xFF;
+    Reg[SIM_UCA0TXBUF]=SIM_EMPTY;
+  }
+  if (Reg[SIM_UCB0TXBUF]!=SIM_EMPTY)
+  {
+    Reg[SIM_UC0IFG]&=~UCB0TXIFG;
+    if (SpiDone==SIM_NEVER) SpiStart(Reg[SIM_UCB0TXBUF]&0xFF);
+    else SpiBuff=Reg[SIM_UCB0TXBUF]&0xFF;
+    Reg[SIM_UCB0TXBUF]=SIM_EMPTY;
+  }
+  p=Reg[SIM_P1OUT];
+  if ((p^LastP1)&SIM_SS)
+  {
+    if (p&SIM_SS) TargetCommit();
+    else
+    {
+      TargetIndex=0;
+      TargetIgnore=false;
+      memset(TargetLoaded,0,sizeof(TargetLoaded));
+    }
+  }
+  LastP1=p;
+}
+
+static SimTime NextEvent()
+{
+  SimTime t=TimerOverflow;
+  if (UartTxDone<t) t=UartTxDone;
+  if (SpiDone<t) t=SpiDone;
+  if (HostRxDone<t) t=HostRxDone;
+  if (HostPauseAt<t) t=HostPauseAt;
+  return t;
+}
+
+static void Events()
+{
+  if (Sim_Now>=TimerOverflow)
+  {
+    TimerOverflow+=0x10000*8;
+    Reg[SIM_TA0CTL]|=TAIFG;
+  }
+  if (Sim_Now>=SpiDone) SpiByteDone();
+  if (Sim_Now>=UartTxDone) UartByteDone();
+  if (Sim_Now>=HostPauseAt)
+  {
+    HostPauseAt=SIM_NEVER;
+    HostPaused=true;
+    HostPauseStart=Sim_Now;
+  }
+  if (Sim_Now>=HostRxDone) HostByteSent();
+  HostStart();
+  if ((Sim_Config.timeout_s>0)&&(Sim_Now>Sim_Config.timeout_s*SIM_HZ)) Sim_Stop(-1);
+}
+
+//Runs the models up to the given time, taking interrupts on the way unless
+//the CPU is already in an ISR
+static void Advance(SimTime until)
+{
+  SimTime t;
+  while ((t=NextEvent())<=until)
+  {
+    if (t>Sim_Now) Sim_Now=t;
+    Events();
+    Dispatch();
+  }
+  if (until>Sim_Now) Sim_Now=until;
+  Dispatch();
+}
+
+static void Dispatch()
+{
+  unsigned int pending;
+  int vector;
+  while ((Gie)&&(!InIsr)&&(Sim_Now>=FlashBusyUntil))
+  {
+    Sync();
+    pending=Reg[SIM_UC0IFG]&Reg[SIM_UC0IE];
+    if ((Reg[SIM_TA0CTL]&(TAIFG|TAIE))==(TAIFG|TAIE)) vector=TIMER0_A1_VECTOR;
+    else if (pending&(UCA0RXIFG|UCB0RXIFG)) vector=USCIAB0RX_VECTOR;
+    else if (pending&(UCA0TXIFG|UCB0TXIFG)) vector=USCIAB0TX_VECTOR;
+    else break;
+    InIsr=true;
+    Sim_Now+=SIM_ISR_CYCLES;
+    Sim_Vector[vector]();
+    Sync();
+    InIsr=false;
+  }
+}
+
+void Sim_Tick()
+{
+  Sync();
+  Advance(Sim_Now+Sim_Config.access_cycles);
+}
+
+bool Sim_InIsr()
+{
+  return InIsr;
+}
+
+volatile unsigned int *Sim_Reg(int reg)
+{
+  Sim_Tick();
+  switch (reg)
+  {
+    case SIM_UCA0RXBUF:
+      Reg[SIM_UC0IFG]&=~UCA0RXIFG;
+      Reg[SIM_UCA0STAT]&=~UCOE;
+      break;
+    case SIM_UCB0RXBUF:
+      Reg[SIM_UC0IFG]&=~UCB0RXIFG;
+      Reg[SIM_UCB0STAT]&=~UCOE;
+      break;
+    case SIM_UCB0STAT:
+      if ((SpiDone!=SIM_NEVER)||(SpiBuff>=0)) Reg[SIM_UCB0STAT]|=UCBUSY;
+      else Reg[SIM_UCB0STAT]&=~UCBUSY;
+      break;
+    case SIM_P2IN:
+      Reg[SIM_P2IN]=Reg[SIM_P2OUT]&(Reg[SIM_P2DIR]|Reg[SIM_P2REN])&0xFF;
+      if ((Sim_Now>=Sim_P2LowFrom)&&(Sim_Now<Sim_P2LowUntil)) Reg[SIM_P2IN]&=~(Sim_P2Low&~Reg[SIM_P2DIR]);
+      break;
+    case SIM_TA0R:
+      Reg[SIM_TA0R]=(Sim_Now/8)&0xFFFF;
+      break;
+    case SIM_TA0IV:
+      Reg[SIM_TA0IV]=(Reg[SIM_TA0CTL]&TAIFG)?TA0IV_TAIFG:0;
+      Reg[SIM_TA0CTL]&=~TAIFG;
+      break;
+    case SIM_FCTL3:
+      if (Sim_Now<FlashBusyUntil) Reg[SIM_FCTL3]|=BUSY;
+      else Reg[SIM_FCTL3]&=~BUSY;
+      break;
+  }
+  return &Reg[reg];
+}
+
+void Sim_Delay(unsigned long cycles)
+{
+  Sync();
+  Advance(Sim_Now+cycles);
+}
+
+void Sim_Interrupts(int enable)
+{
+  Gie=enable;
+  Sim_Tick();
+}
+
+void Sim_HostSend(const void *data, size_t count)
+{
+  if (HostQueueTail+count>HostQueueSize)
+  {
+    memmove(HostQueue,HostQueue+HostQueueHead,HostQueueTail-HostQueueHead);
+    HostQueueTail-=HostQueueHead;
+    HostQueueHead=0;
+    if (HostQueueTail+count>HostQueueSize)
+    {
+      HostQueueSize=(HostQueueTail+count)*2;
+      HostQueue=realloc(HostQueue,HostQueueSize);
+      if (!HostQueue)
+      {
+        perror("realloc");
+        exit(1);
+      }
+    }
+  }
+  memcpy(HostQueue+HostQueueTail,data,count);
+  HostQueueTail+=count;
+  HostStart();
+}
+
+size_t Sim_HostPending()
+{
+  return HostQueueTail-HostQueueHead+(HostRxDone!=SIM_NEVER);
+}
+
+//Keeps what it holds across Sim_Reset, like the real part
+void Sim_Flash(const void *base, size_t size)
+{
+  struct sigaction action;
+  FlashBase=(unsigned char *)base;
+  FlashSize=size;
+  FlashPending=0;
+  FlashProtect(PROT_READ);
+  memset(&action,0,sizeof(action));
+  action.sa_sigaction=FlashTrap;
+  action.sa_flags=SA_SIGINFO|SA_NODEFER;
+  sigaction(SIGSEGV,&action,0);
+}
+
+//Powers everything up with a blank AT89LP6440 attached
+void Sim_Reset()
+{
+  int i;
+  for (i=0;i<SIM_REGISTERS;i++) Reg[i]=0;
+  Reg[SIM_UC0IFG]=UCA0TXIFG|UCB0TXIFG;
+  Reg[SIM_UCA0TXBUF]=SIM_EMPTY;
+  Reg[SIM_UCB0TXBUF]=SIM_EMPTY;
+  Reg[SIM_FCTL3]=LOCK;
+  Gie=InIsr=false;
+  Seed=Sim_Config.seed;
+  Sim_Now=0;
+  if (FlashPending) FlashCommit();
+  FlashBusyUntil=0;
+  memset(&Sim_Stats,0,sizeof(Sim_Stats));
+
+  UartTxDone=SIM_NEVER;
+  UartTxBuff=-1;
+  HostQueueHead=HostQueueTail=0;
+  HostRxDone=HostPauseAt=SIM_NEVER;
+  HostNextAllowed=0;
+  HostPaused=false;
+  HostBurstLeft=Sim_Config.burst_max?1+Sim_Random(Sim_Config.burst_max):0;
+
+  SpiDone=SIM_NEVER;
+  SpiBuff=-1;
+  LastP1=0;
+  TargetIndex=0;
+  TargetIgnore=true;
+  TargetBusyUntil=0;
+  memset(Sim_TargetFlash,0xFF,sizeof(Sim_TargetFlash));
+  memset(Sim_TargetFuses,0xFF,sizeof(Sim_TargetFuses));
+  memset(Sim_TargetLocks,0xFF,sizeof(Sim_TargetLocks));
+  Sim_TargetSignature[0]=0x1E;
+  Sim_TargetSignature[1]=0x64;
+  Sim_TargetSignature[2]=0xFF;
+  Sim_TargetPageSize=64;
+  Sim_TargetPresent=true;
+  Sim_P2Low=0;
+  Sim_P2LowFrom=Sim_P2LowUntil=0;
+
+  TimerOverflow=0x10000*8;
+}
+
+//Runs entry until Sim_Stop and returns the stop code
+int Sim_Run(void (*entry)(void))
+{
+  StopCode=0;
+  if (setjmp(Exit)==0) entry();
+  if (HostPaused) Sim_Stats.host_paused+=Sim_Now-HostPauseStart;
+  InIsr=false;
+  return StopCode;
+}
+
+void Sim_Stop(int code)
+{
+  StopCode=code;
+  longjmp(Exit,1);
+}
@@ -0,0 +1,108 @@
+/**   AT89LP6440 Programmer host simulator
+ *    Copyright (C) 2014 Joey Shepard
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+/*  Models shared by the host benchmark and stress harness. Time is counted
+ *  in 16MHz CPU cycles. The firmware sees a double buffered USCI_A0 UART,
+ *  a USCI_B0 SPI master and Timer_A0 through the registers in msp430.h;
+ *  on the far side of them sit a host that honours XON/XOFF and an AT89LP
+ *  target with a timed busy state.
+**/
+
+#ifndef SIM_SIM_H
+#define SIM_SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SIM_HZ            16000000ULL
+#define SIM_MS            (SIM_HZ/1000)
+#define SIM_US            (SIM_HZ/1000000)
+
+typedef unsigned long long SimTime;
+
+typedef struct
+{
+  unsigned long baud;           //0 takes the rate from UCA0BR0/1 and UCA0MCTL
+  unsigned int access_cycles;   //CPU time charged per register or hooked access
+  unsigned long write_us;       //Target page and fuse write busy time
+  unsigned long erase_us;       //Target chip erase busy time
+  unsigned long busy_jitter_us; //Random extra busy time per write
+  unsigned long spi_jitter;     //Random extra cycles per SPI byte
+  unsigned long xoff_us;        //Host reaction time to XOFF
+  unsigned long xoff_jitter_us; //Random extra reaction time
+  unsigned int burst_max;       //Host sends bursts of 1..burst_max bytes, 0 for a steady stream
+  unsigned long gap_max_us;     //Idle time of up to this between bursts
+  double timeout_s;             //Simulated time limit of a run
+  unsigned int seed;
+} SimConfig;
+
+typedef struct
+{
+  unsigned long host_sent;      //Bytes put on the line by the host
+  unsigned long host_received;  //Bytes the firmware sent back
+  SimTime host_paused;          //Cycles the host held off after XOFF
+  SimTime target_busy;          //Cycles the target spent writing or erasing
+  unsigned long target_writes;
+  unsigned long target_erases;
+  unsigned long violations;     //Commands sent to a busy target
+  unsigned long overruns;       //Bytes lost to UCOE
+  unsigned long flash_violations;//MSP430 flash stores dropped, or setting bits
+} SimStats;
+
+extern SimConfig Sim_Config;
+extern SimStats Sim_Stats;
+extern SimTime Sim_Now;
+
+//Target memory, fuses and identity, reset by Sim_Reset
+extern unsigned char Sim_TargetFlash[0x10000];
+extern unsigned char Sim_TargetFuses[16];
+extern unsigned char Sim_TargetLocks[2];
+extern unsigned char Sim_TargetSignature[3];
+extern unsigned int Sim_TargetPageSize;
+extern bool Sim_TargetPresent;
+
+//P2 inputs held low from outside from one time until another, such as a
+//pressed button. Other inputs read their pull resistor, or 0 when it is off.
+extern unsigned char Sim_P2Low;
+extern SimTime Sim_P2LowFrom,Sim_P2LowUntil;
+
+//Interrupt service routines, filled in by Firmware_Init
+extern void (*Sim_Vector[3])(void);
+
+//Called by the model for every byte the host receives, and from the main
+//loop's wait for input once the firmware is idle. Either may Sim_Stop.
+extern void (*Sim_OnOutput)(unsigned char data);
+extern void (*Sim_OnIdle)(void);
+
+void Sim_Reset();
+void Sim_HostSend(const void *data, size_t count);
+size_t Sim_HostPending();
+void Sim_Flash(const void *base, size_t size);
+void Sim_Tick();
+bool Sim_InIsr();
+int Sim_Run(void (*entry)(void));
+void Sim_Stop(int code);
+unsigned long Sim_Baud();
+unsigned long Sim_Random(unsigned long range);
+
+//Ring sizes the firmware was built with
+extern const int Firmware_RxRing,Firmware_TxRing,Firmware_SpiRing;
+
+void Firmware_Init();
+void Firmware_Main();
+
+#endif
@@ -0,0 +1,259 @@
+/**   AT89LP6440 Programmer host simulator
+ *    Copyright (C) 2014 Joey Shepard
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+/*  Flow control stress test. The firmware's own main loop runs L on a
+ *  random image of full pages sent as page aligned HEX records. The host
+ *  sends in random bursts and reacts to XOFF late by a random amount; SPI
+ *  bytes and target busy times get random extra latency. A trial passes
+ *  when no record fails its checksum, L reports no fault, the target flash
+ *  matches the image, no byte is dropped or overrun and nothing is sent to
+ *  a busy target.
+ *
+ *  A binary search over the line rate finds the fastest one at which all
+ *  trials pass. sim/stress.sh repeats it for each RX, TX and SPI ring size.
+ *
+ *  stress [-n bytes] [-t trials] [-R baud] [-r reclen] [-x xoff_us]
+ *         [-j xoff_jitter_us] [-b burst_max] [-g gap_max_us]
+ *         [-p spi_jitter_cycles] [-w write_us] [-k busy_jitter_us]
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define PAGESIZE  64
+#define MINBAUD   1200
+#define MAXBAUD   1000000
+#define QUIET_MS  50//Plus 100 character times
+
+extern volatile unsigned char Fault_Counts[];
+
+typedef struct
+{
+  unsigned long bad_records,wrong_bytes,drop,oe,violations;
+  bool fault;
+  int code;
+} Result;
+
+unsigned long Bytes=4096;
+int RecordBytes=PAGESIZE;
+int Trials=8;
+Result Trial;
+
+unsigned char Image[0x10000];
+char *Hex;
+size_t HexLen,HexSize;
+int Step,Lines;
+SimTime Quiet,QuietLimit;
+
+void Append(const char *text, size_t count)
+{
+  if (HexLen+count+1>HexSize)
+  {
+    HexSize=(HexLen+count+1)*2;
+    Hex=realloc(Hex,HexSize);
+    if (!Hex)
+    {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  memcpy(Hex+HexLen,text,count);
+  HexLen+=count;
+  Hex[HexLen]=0;
+}
+
+void Record(unsigned int address, unsigned char type, unsigned char *data, int len)
+{
+  char text[16];
+  unsigned char crc;
+  int i;
+  crc=len+(address>>8)+(address&0xFF)+type;
+  Append(text,sprintf(text,":%02X%04X%02X",len,address,type));
+  for (i=0;i<len;i++)
+  {
+    Append(text,sprintf(text,"%02X",data[i]));
+    crc+=data[i];
+  }
+  Append(text,sprintf(text,"%02X\r\n",(unsigned char)-crc));
+}
+
+//Fresh data every trial, so a byte lost anywhere changes what reaches flash
+void MakeImage()
+{
+  unsigned long i;
+  memset(Image,0xFF,sizeof(Image));
+  HexLen=0;
+  Append("L\r",2);
+  for (i=0;i<Bytes;i++) Image[i]=Sim_Random(256);
+  for (i=0;i<Bytes;i+=RecordBytes) Record(i,0,Image+i,RecordBytes);
+  Record(0,1,0,0);
+}
+
+//The first prompt starts L, the next one ends the trial. The line after
+//the echo holds one '.' or 'C' per record and any text after it is a fault.
+void OnOutput(unsigned char data)
+{
+  if ((!Step)&&(data!='>')) return;
+  if ((data==0x11)||(data==0x13)) return;
+  if (data=='\n') Lines++;
+  else if ((Lines==1)&&(data=='C')) Trial.bad_records++;
+  else if ((Lines>1)&&(data!='\r')&&(data!='>')) Trial.fault=true;
+  if (data!='>') return;
+  if (Step++) Sim_Stop(0);
+  Lines=0;
+  Quiet=Sim_Now;
+  Sim_HostSend(Hex,HexLen);
+}
+
+//L still waiting for input once the host has gone quiet lost a record end
+void OnIdle()
+{
+  if (Sim_HostPending()) Quiet=Sim_Now;
+  else if ((Step)&&(Sim_Now-Quiet>QuietLimit)) Sim_Stop(1);
+}
+
+int Run(unsigned long baud, unsigned int seed)
+{
+  unsigned long i;
+  memset(&Trial,0,sizeof(Trial));
+  Sim_Config.baud=baud;
+  Sim_Config.seed=seed;
+  Sim_Reset();
+  MakeImage();
+  Sim_Config.timeout_s=1+HexLen*20.0/baud;//Twice the line time
+  QuietLimit=QUIET_MS*SIM_MS+1000*SIM_HZ/baud;
+  Firmware_Init();
+  Step=0;
+  Sim_OnOutput=OnOutput;
+  Sim_OnIdle=OnIdle;
+  Trial.code=Sim_Run(Firmware_Main);
+  for (i=0;i<sizeof(Image);i++) if (Image[i]!=Sim_TargetFlash[i]) Trial.wrong_bytes++;
+  Trial.drop=Fault_Counts[0];
+  Trial.oe=Fault_Counts[1];
+  Trial.violations=Sim_Stats.violations;
+  return (Trial.code==0)&&(!Trial.bad_records)&&(!Trial.fault)&&(!Trial.wrong_bytes)&&(!Trial.drop)&&(!Trial.oe)&&(!Trial.violations);
+}
+
+//All trials must pass; the first failure is kept for the report
+bool Safe(unsigned long baud, Result *failure)
+{
+  int i;
+  for (i=0;i<Trials;i++)
+  {
+    if (!Run(baud,i+1))
+    {
+      *failure=Trial;
+      return false;
+    }
+  }
+  return true;
+}
+
+void PrintResult(const char *name, Result *result)
+{
+  printf("\"%s\":{\"bad_records\":%lu,\"fault\":%s,\"wrong_bytes\":%lu,\"drop\":%lu,\"oe\":%lu,\"violations\":%lu,\"timeout\":%s}",
+    name,result->bad_records,result->fault?"true":"false",result->wrong_bytes,result->drop,result->oe,
+    result->violations,result->code?"true":"false");
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long low=MINBAUD,high=MAXBAUD,mid,fixed=0;
+  Result failure,first={0};
+  int i;
+
+  Sim_Config.access_cycles=4;
+  Sim_Config.write_us=2500;
+  Sim_Config.busy_jitter_us=2500;
+  Sim_Config.spi_jitter=32;
+  Sim_Config.xoff_jitter_us=1000;
+  Sim_Config.burst_max=64;
+  Sim_Config.gap_max_us=200;
+  Sim_Config.erase_us=20000;
+
+  for (i=1;i<argc;i++)
+  {
+    if ((!strcmp(argv[i],"-n"))&&(i+1<argc)) Bytes=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-t"))&&(i+1<argc)) Trials=strtol(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-R"))&&(i+1<argc)) fixed=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-r"))&&(i+1<argc)) RecordBytes=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-x"))&&(i+1<argc)) Sim_Config.xoff_us=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-j"))&&(i+1<argc)) Sim_Config.xoff_jitter_us=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-b"))&&(i+1<argc)) Sim_Config.burst_max=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-g"))&&(i+1<argc)) Sim_Config.gap_max_us=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-p"))&&(i+1<argc)) Sim_Config.spi_jitter=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-w"))&&(i+1<argc)) Sim_Config.write_us=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-k"))&&(i+1<argc)) Sim_Config.busy_jitter_us=strtoul(argv[++i],0,0);
+    else
+    {
+      fprintf(stderr,"usage: stress [-n bytes] [-t trials] [-R baud] [-r reclen] [-x xoff_us] [-j xoff_jitter_us]\n"
+        "              [-b burst_max] [-g gap_max_us] [-p spi_jitter_cycles] [-w write_us] [-k busy_jitter_us]\n");
+      return 1;
+    }
+  }
+  if ((Bytes==0)||(Bytes>0x10000)||(Bytes%PAGESIZE)||(Trials<1)||(RecordBytes<1)||(RecordBytes>PAGESIZE)||(PAGESIZE%RecordBytes))
+  {
+    fprintf(stderr,"bytes must be a multiple of %d up to 64K, trials nonzero and reclen divide %d\n",PAGESIZE,PAGESIZE);
+    return 1;
+  }
+
+  printf("{\"rxbuf\":%d,\"txbuf\":%d,\"spibuf\":%d,\"bytes\":%lu,\"trials\":%d,\"reclen\":%d,"
+    "\"xoff_us\":%lu,\"xoff_jitter_us\":%lu,\"burst_max\":%u,\"gap_max_us\":%lu,\"spi_jitter\":%lu,"
+    "\"write_us\":%lu,\"busy_jitter_us\":%lu,",
+    Firmware_RxRing,Firmware_TxRing,Firmware_SpiRing,Bytes,Trials,RecordBytes,
+    Sim_Config.xoff_us,Sim_Config.xoff_jitter_us,Sim_Config.burst_max,Sim_Config.gap_max_us,
+    Sim_Config.spi_jitter,Sim_Config.write_us,Sim_Config.busy_jitter_us);
+
+  if (fixed)
+  {
+    i=Safe(fixed,&failure);
+    printf("\"baud\":%lu,\"safe\":%s",fixed,i?"true":"false");
+    if (!i)
+    {
+      printf(",");
+      PrintResult("failure",&failure);
+    }
+    printf("}\n");
+    return i?0:1;
+  }
+
+  //Largest rate that passes, assuming failures only get worse with speed
+  if (!Safe(low,&first))
+  {
+    printf("\"max_safe_baud\":null,\"first_unsafe_baud\":%lu,",low);
+    PrintResult("failure",&first);
+    printf("}\n");
+    return 1;
+  }
+  while (high-low>low/100)
+  {
+    mid=(low+high)/2;
+    if (Safe(mid,&failure)) low=mid;
+    else
+    {
+      high=mid;
+      first=failure;
+    }
+  }
+  printf("\"max_safe_baud\":%lu,\"first_unsafe_baud\":%lu,",low,high);
+  PrintResult("failure",&first);
+  printf("}\n");
+  return 0;
+}
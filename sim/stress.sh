@@ -0,0 +1,23 @@
+#!/bin/sh
+# Builds the stress harness once per ring size and searches each for the
+# fastest safe line rate, printing one JSON line per build. The RX, TX and
+# SPI rings are swept one at a time, the others left at their defaults.
+# Extra arguments go to every stress run.
+#
+#   sim/stress.sh [stress options] > stress.json
+
+cd "$(dirname "$0")/.." || exit 1
+out=${TMPDIR:-/tmp}/at89stress.$$
+mkdir -p "$out" || exit 1
+trap 'rm -rf "$out"' EXIT
+
+status=0
+for ring in UARTRXBUFFERSIZE=16 UARTRXBUFFERSIZE=32 UARTRXBUFFERSIZE=64 UARTRXBUFFERSIZE=128 \
+  RINGBUFFERSIZE=4 RINGBUFFERSIZE=16 RINGBUFFERSIZE=64 \
+  SPIBUFFERSIZE=4 SPIBUFFERSIZE=16 SPIBUFFERSIZE=64
+do
+  ${CC:-cc} -O2 -Isim -D"$ring" -o "$out/stress" \
+    sim/stress.c sim/sim.c sim/firmware.c || exit 1
+  "$out/stress" "$@" || status=1
+done
+exit $status
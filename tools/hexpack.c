@@ -0,0 +1,226 @@
+/**   AT89LP6440 Programmer image packer
+ *    Copyright (C) 2014 Joey Shepard
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+/*  Host side preprocessor for the L command. Reads Intel HEX (including
+ *  extended segment and linear address records) or raw binary, merges
+ *  overlapping and out of order records into one image, splits it into
+ *  page aligned blocks, drops blank (all 0xFF) pages and writes an ordered
+ *  Intel HEX stream with one record per page. Every page then reaches the
+ *  programmer whole and exactly once.
+ *
+ *  cc -O2 -o hexpack tools/hexpack.c
+ *  hexpack [-p pagesize] [-r reclen] [-b base] [-o out.hex] in.hex|in.bin ...
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define IMAGESIZE   0x10000
+#define MAXPAGESIZE 64//Largest record the firmware's L buffer (INBUFFLEN 72) holds
+#define MAXLINE     600
+
+unsigned char image[IMAGESIZE];
+bool used[IMAGESIZE];
+int overlaps;
+
+int HexDigit(int c)
+{
+  if ((c>='0')&&(c<='9')) return c-'0';
+  if ((c>='a')&&(c<='f')) return c-'a'+10;
+  if ((c>='A')&&(c<='F')) return c-'A'+10;
+  return -1;
+}
+
+void Store(unsigned long address, unsigned char data, const char *name)
+{
+  if (address>=IMAGESIZE)
+  {
+    fprintf(stderr,"%s: address %05lX outside 64K address space\n",name,address);
+    exit(1);
+  }
+  if ((used[address])&&(image[address]!=data)) overlaps++;
+  image[address]=data;
+  used[address]=true;
+}
+
+void LoadHex(FILE *in, const char *name)
+{
+  char line[MAXLINE];
+  unsigned char rec[MAXLINE/2];
+  unsigned long base=0;
+  int lineno=0,len,i,hi,lo;
+  unsigned char crc;
+
+  while (fgets(line,sizeof(line),in))
+  {
+    lineno++;
+    len=strcspn(line,"\r\n");
+    line[len]=0;
+    if (len==0) continue;
+    if ((line[0]!=':')||(len<11)||(!(len&1)))
+    {
+      fprintf(stderr,"%s:%d: malformed record\n",name,lineno);
+      exit(1);
+    }
+    crc=0;
+    for (i=0;i<(len-1)/2;i++)
+    {
+      hi=HexDigit(line[i*2+1]);
+      lo=HexDigit(line[i*2+2]);
+      if ((hi<0)||(lo<0))
+      {
+        fprintf(stderr,"%s:%d: bad hex digit\n",name,lineno);
+        exit(1);
+      }
+      rec[i]=hi*16+lo;
+      crc+=rec[i];
+    }
+    if ((rec[0]!=i-5)||(crc))
+    {
+      fprintf(stderr,"%s:%d: bad length or checksum\n",name,lineno);
+      exit(1);
+    }
+
+    switch (rec[3])
+    {
+      case 0:
+        for (i=0;i<rec[0];i++) Store(base+((rec[1]*256+rec[2]+i)&0xFFFF),rec[4+i],name);
+        break;
+      case 1:
+        return;
+      case 2:
+        base=(unsigned long)(rec[4]*256+rec[5])<<4;
+        break;
+      case 4:
+        base=(unsigned long)(rec[4]*256+rec[5])<<16;
+        break;
+      case 3:
+      case 5:
+        //Start address records mean nothing to the programmer
+        break;
+      default:
+        fprintf(stderr,"%s:%d: unknown record type %02X\n",name,lineno,rec[3]);
+        exit(1);
+    }
+  }
+}
+
+void LoadBin(FILE *in, const char *name, unsigned long base)
+{
+  int c;
+  while ((c=fgetc(in))!=EOF) Store(base++,c,name);
+}
+
+void EmitRecord(FILE *out, unsigned int address, unsigned char type, unsigned char *data, int len)
+{
+  unsigned char crc;
+  int i;
+
+  crc=len+(address>>8)+(address&0xFF)+type;
+  fprintf(out,":%02X%04X%02X",len,address,type);
+  for (i=0;i<len;i++)
+  {
+    fprintf(out,"%02X",data[i]);
+    crc+=data[i];
+  }
+  fprintf(out,"%02X\n",(unsigned char)-crc);
+}
+
+void Usage()
+{
+  fprintf(stderr,"usage: hexpack [-p pagesize] [-r reclen] [-b base] [-o out.hex] in.hex|in.bin ...\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *in,*out=stdout;
+  unsigned long base=0,address;
+  int pagesize=64,reclen=0,i,first,last,pages=0,blank=0,len;
+  const char *ext;
+
+  memset(image,0xFF,sizeof(image));
+
+  for (i=1;i<argc;i++)
+  {
+    if ((!strcmp(argv[i],"-p"))&&(i+1<argc)) pagesize=strtol(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-r"))&&(i+1<argc)) reclen=strtol(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-b"))&&(i+1<argc)) base=strtoul(argv[++i],0,0);
+    else if ((!strcmp(argv[i],"-o"))&&(i+1<argc))
+    {
+      out=fopen(argv[++i],"w");
+      if (!out)
+      {
+        perror(argv[i]);
+        return 1;
+      }
+    }
+    else if (argv[i][0]=='-') Usage();
+    else
+    {
+      in=fopen(argv[i],"rb");
+      if (!in)
+      {
+        perror(argv[i]);
+        return 1;
+      }
+      ext=strrchr(argv[i],'.');
+      if ((ext)&&((!strcmp(ext,".hex"))||(!strcmp(ext,".HEX"))||(!strcmp(ext,".ihx")))) LoadHex(in,argv[i]);
+      else LoadBin(in,argv[i],base);
+      fclose(in);
+    }
+  }
+
+  if ((pagesize<1)||(pagesize>MAXPAGESIZE)||(pagesize&(pagesize-1))) Usage();
+  if (reclen==0) reclen=pagesize;
+  if ((reclen<1)||(reclen>pagesize)||(pagesize%reclen)) Usage();
+
+  for (address=0;address<IMAGESIZE;address+=pagesize)
+  {
+    for (first=0;first<pagesize;first++) if (image[address+first]!=0xFF) break;
+    if (first==pagesize)
+    {
+      for (i=0;i<pagesize;i++) if (used[address+i]) break;
+      if (i<pagesize) blank++;
+      continue;
+    }
+    pages++;
+
+    if (reclen==pagesize)
+    {
+      //One record per page, leading and trailing 0xFF trimmed. The
+      //programmer still issues a single page write for it.
+      for (last=pagesize-1;image[address+last]==0xFF;last--);
+      EmitRecord(out,address+first,0,image+address+first,last-first+1);
+    }
+    else
+    {
+      for (i=0;i<pagesize;i+=reclen)
+      {
+        for (len=0;len<reclen;len++) if (image[address+i+len]!=0xFF) break;
+        if (len<reclen) EmitRecord(out,address+i,0,image+address+i,reclen);
+      }
+    }
+  }
+  EmitRecord(out,0,1,0,0);
+
+  fprintf(stderr,"%d pages, %d blank pages dropped, %d overlapping bytes\n",pages,blank,overlaps);
+  if (out!=stdout) fclose(out);
+  return 0;
+}
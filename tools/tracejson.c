@@ -0,0 +1,157 @@
+/**   AT89LP6440 Programmer trace converter
+ *    Copyright (C) 2014 Joey Shepard
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**/
+
+/*  Turns the output of the T command into Chrome trace JSON (load it in
+ *  chrome://tracing or Perfetto) or, with -t, a plain text timeline. Flash
+ *  busy polls, XOFF periods and ring stalls become duration events on their
+ *  own tracks; SPI commands are instant events. Event codes come from the
+ *  firmware's AT89_Trace.h, and a dump of another TRACE_VERSION is refused.
+ *
+ *  cc -O2 -o tracejson tools/tracejson.c
+ *  tracejson [-t] < capture.txt > trace.json
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "../AT89_Trace.h"
+
+#define TRACK_SPI     1
+#define TRACK_BUSY    2
+#define TRACK_XOFF    3
+#define TRACK_STALL   4
+
+bool text;
+bool first=true;
+
+const char *EventName(int event)
+{
+  switch (event)
+  {
+    case TRACE_BUSYDONE:      return "FLASH BUSY";
+    case TRACE_XOFF:          return "XOFF";
+    case TRACE_XON:           return "XOFF";
+    case TRACE_TXSTALL:       return "UART TX RING FULL";
+    case TRACE_SPISTALL:      return "SPI RING FULL";
+    case TRACE_STALLDONE:     return "STALL";
+    case TRACE_CMD_READ:      return "READ PAGE 30";
+    case TRACE_CMD_WRITE:     return "WRITE PAGE 50";
+    case TRACE_CMD_STATUS:    return "READ STATUS 60";
+    case TRACE_CMD_ERASE:     return "CHIP ERASE 8A";
+  }
+  return "UNKNOWN";
+}
+
+void Emit(const char *name, char phase, int track, double us)
+{
+  if (text)
+  {
+    printf("%12.1f  %c  %s\n",us,phase,name);
+    return;
+  }
+  printf("%s\n  {\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.1f%s}",
+    first?"":",",name,phase,track,us,phase=='i'?",\"s\":\"t\"":"");
+  first=false;
+}
+
+int main(int argc, char *argv[])
+{
+  char word[64];
+  unsigned int count,hz,version,value;
+  unsigned long long base=0,ticks,start=0;
+  unsigned int i;
+  int event,stall=0;
+  double us;
+  bool timed=false;
+
+  if ((argc>1)&&(!strcmp(argv[1],"-t"))) text=true;
+  else if (argc>1)
+  {
+    fprintf(stderr,"usage: tracejson [-t] < capture.txt\n");
+    return 1;
+  }
+
+  while (scanf("%63s",word)==1) if (!strcmp(word,"TRACE")) break;
+  if ((scanf("%x %x %x",&count,&hz,&version)!=3)||(hz==0))
+  {
+    fprintf(stderr,"no TRACE header found\n");
+    return 1;
+  }
+  if (version!=TRACE_VERSION)
+  {
+    fprintf(stderr,"trace version %u, this converter reads %u\n",version,TRACE_VERSION);
+    return 1;
+  }
+
+  if (!text) printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for (i=0;i<count;i++)
+  {
+    if ((scanf("%63s",word)!=1)||(strlen(word)!=4)||(sscanf(word,"%x",&value)!=1))
+    {
+      fprintf(stderr,"trace entry %u is malformed\n",i);
+      return 1;
+    }
+    //Raw TA0R with the event in the low 4 bits. A wrap entry counts the
+    //times TA0R has wrapped since the entry before it, up to 0xFFF.
+    event=value&0x0F;
+    if (event==TRACE_WRAP)
+    {
+      base+=(value>>4)*0x10000ULL;
+      continue;
+    }
+    ticks=base+(value&0xFFF0);
+    if (!timed)
+    {
+      start=ticks;
+      timed=true;
+    }
+    us=(ticks-start)*1e6/hz;
+
+    switch (event)
+    {
+      case TRACE_CMD_STATUS:
+        Emit(EventName(event),'i',TRACK_SPI,us);
+        Emit("FLASH BUSY",'B',TRACK_BUSY,us);
+        break;
+      case TRACE_BUSYDONE:
+        Emit("FLASH BUSY",'E',TRACK_BUSY,us);
+        break;
+      case TRACE_XOFF:
+        Emit("XOFF",'B',TRACK_XOFF,us);
+        break;
+      case TRACE_XON:
+        Emit("XOFF",'E',TRACK_XOFF,us);
+        break;
+      case TRACE_TXSTALL:
+      case TRACE_SPISTALL:
+        stall=event;
+        Emit(EventName(event),'B',TRACK_STALL,us);
+        break;
+      case TRACE_STALLDONE:
+        if ((stall)||(text)) Emit(stall?EventName(stall):"STALL",'E',TRACK_STALL,us);
+        stall=0;
+        break;
+      default:
+        Emit(EventName(event),'i',TRACK_SPI,us);
+        break;
+    }
+  }
+  if (!text) printf("\n]}\n");
+  return 0;
+}